@@ -43,8 +43,52 @@
 #include <Psapi.h>
 #include <algorithm>
 #include <iomanip>
+#include <cctype>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#define P1_SIMD_AVX2
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#define P1_SIMD_NEON
+#endif
 static bool g_bEnableProfiler1 = false;
 
+// dll notifications of ntdll, not declared by the sdk headers
+struct P1_UnicodeString {
+	USHORT Length;
+	USHORT MaximumLength;
+	PWSTR Buffer;
+};
+
+struct P1_DllNotificationData {
+	ULONG Flags;
+	const P1_UnicodeString * FullDllName;
+	const P1_UnicodeString * BaseDllName;
+	PVOID DllBase;
+	ULONG SizeOfImage;
+};
+
+#define P1_DLL_LOADED 1
+#define P1_DLL_UNLOADED 2
+
+typedef VOID (CALLBACK * P1_DllNotificationFunction)(ULONG, const P1_DllNotificationData *, PVOID);
+typedef LONG (NTAPI * P1_LdrRegisterDllNotification)(ULONG, P1_DllNotificationFunction, PVOID, PVOID *);
+typedef LONG (NTAPI * P1_LdrUnregisterDllNotification)(PVOID);
+
+// called with the loader lock held, only queues the event: the headers are
+// read by P1_ModuleMap::Update(), outside of the lock
+static VOID CALLBACK OnDllNotification(ULONG ulReason, const P1_DllNotificationData * pData, PVOID pContext)
+{
+	P1_ModuleMap * pModules = (P1_ModuleMap *)pContext;
+	if (ulReason == P1_DLL_LOADED) {
+		pModules->Notify(true, (DWORD64)(ULONG_PTR)pData->DllBase, pData->SizeOfImage,
+			pData->FullDllName->Buffer, pData->FullDllName->Length / sizeof(WCHAR));
+	} else if (ulReason == P1_DLL_UNLOADED) {
+		pModules->Notify(false, (DWORD64)(ULONG_PTR)pData->DllBase, pData->SizeOfImage, NULL, 0);
+	}
+}
+
 Profiler1::GC::~GC()
 {
 	if (s_pInstance) {
@@ -69,7 +113,22 @@ Profiler1::Profiler1() {
 	bStart = false;
 	g_bEnableProfiler1 = false;
 	bEnableMemoryProfile = false;
+	dOutlierPercentile = 95;
+	dOutlierMADs = 3;
+	m_unBaselineFrameTime = 0;
 	dwTargetThread = GetCurrentThreadId();
+	m_hLiveMapping = NULL;
+	m_pLiveView = NULL;
+	InitializeCriticalSection(&m_csFlows);
+	m_unFlowEpoch = 1;
+
+	// keep the module map up to date when dlls are loaded later
+	m_pDllNotificationCookie = NULL;
+	P1_LdrRegisterDllNotification pRegister = (P1_LdrRegisterDllNotification)GetProcAddress(
+		GetModuleHandleA("ntdll.dll"), "LdrRegisterDllNotification");
+	if (pRegister) {
+		pRegister(0, OnDllNotification, &m_modules, &m_pDllNotificationCookie);
+	}
 }
 
 Profiler1& Profiler1::GetInstance() {
@@ -86,6 +145,16 @@ Profiler1* Profiler1::GetInstancePtr()
 
 Profiler1::~Profiler1() {
 	g_bEnableProfiler1 = false;
+	CloseLiveView();
+	P1_LdrUnregisterDllNotification pUnregister = (P1_LdrUnregisterDllNotification)GetProcAddress(
+		GetModuleHandleA("ntdll.dll"), "LdrUnregisterDllNotification");
+	if (pUnregister && m_pDllNotificationCookie) {
+		pUnregister(m_pDllNotificationCookie);
+	}
+	for (size_t i = 0; i < m_vecFlowBuffers.size(); i++) {
+		delete m_vecFlowBuffers[i];
+	}
+	DeleteCriticalSection(&m_csFlows);
 	SymCleanup(GetCurrentProcess());
 }
 
@@ -114,6 +183,33 @@ std::string Profiler1::GetFunctionName(DWORD64 dwAddr) {
 	return "";
 }
 
+std::string Profiler1::GetModuleName(DWORD64 dwAddr, DWORD64& dwOffset) {
+	return GetModuleTitle(m_modules.Find(dwAddr, dwOffset));
+}
+
+std::string Profiler1::GetModuleTitle(unsigned idModule) {
+	P1_Module module;
+	if (!m_modules.GetModule(idModule, module)) {
+		return "";
+	}
+	size_t szSlash = module.strPath.find_last_of("\\/");
+	return szSlash == std::string::npos ? module.strPath : module.strPath.substr(szSlash + 1);
+}
+
+std::string Profiler1::GetSourceFile(DWORD64 dwAddr) {
+	if (dwAddr & P1_ZONE_FLAG) {
+		return "";
+	}
+	IMAGEHLP_LINE64 line;
+	memset(&line, 0, sizeof(line));
+	line.SizeOfStruct = sizeof(line);
+	DWORD dwDisplacement = 0;
+	if (!SymGetLineFromAddr64(GetCurrentProcess(), dwAddr, &dwDisplacement, &line) || !line.FileName) {
+		return "";
+	}
+	return line.FileName;
+}
+
 const char *  Profiler1::echo() {
 	return "echo";
 }
@@ -123,8 +219,27 @@ void Profiler1::Start()
 	m_vecFrames.clear();
 	m_vecMsgs.clear();
 	m_vecStats.clear();
-	m_mapStats.clear();
-	m_stackFrames = std::stack<unsigned int>();
+	m_vecFrameStats.clear();
+	m_vecCounterStats.clear();
+	m_stackFrames = std::stack<P1_ShadowFrame>();
+	m_vecCoroSegments.clear();
+	m_mapCoroStacks.clear();
+	m_vecPaths.clear();
+	m_vecPathStats.clear();
+	m_mapPathIds.clear();
+	m_vecLiveStats.clear();
+	m_vecLiveTop.clear();
+	m_vecLiveInTop.clear();
+	m_vecFlows.clear();
+	m_vecFlowStats.clear();
+	m_unFlowEpoch++;
+	m_modules.Refresh();
+	if (m_pLiveView) {
+		InterlockedIncrement(&m_pLiveView->lSequence);
+		m_pLiveView->unFrames = 0;
+		m_pLiveView->unFunctions = 0;
+		InterlockedIncrement(&m_pLiveView->lSequence);
+	}
 
 	bStart = true;
 
@@ -139,11 +254,13 @@ void Profiler1::FrameStart()
 	if (!bStart) {
 		return;
 	}
-	m_vecFrames.push_back(P1_Frame());
-	m_stackFrames = std::stack<unsigned int>();
+	m_vecFrames.push_back(P1_FrameData());
+	m_stackFrames = std::stack<P1_ShadowFrame>();
+	m_vecCoroSegments.clear();
+	m_registry.Sync(m_modules);
 
 	size_t szFrames = m_vecFrames.size();
-	P1_Frame& frame = m_vecFrames[szFrames - 1];
+	P1_FrameData& frame = m_vecFrames[szFrames - 1];
 	frame.id = szFrames - 1;
 	if (bEnableMemoryProfile){
 		PROCESS_MEMORY_COUNTERS infoPMC;
@@ -164,11 +281,13 @@ void Profiler1::Stop()
 	g_bEnableProfiler1 = false;
 	bStart = false;
 
-	if (!m_stackFrames.empty()) {
+	if (!m_vecFrames.empty() && m_vecFrames.back().i64EndTime == 0) {
 
 		// pop incomplete last frame
 		m_vecFrames.pop_back();
 	}
+	m_stackFrames = std::stack<P1_ShadowFrame>();
+	m_vecCoroSegments.clear();
 }
 
 void Profiler1::FrameEnd()
@@ -178,7 +297,7 @@ void Profiler1::FrameEnd()
 	if (size <= 0) {
 		return;
 	}
-	P1_Frame& frame = m_vecFrames[size - 1];
+	P1_FrameData& frame = m_vecFrames[size - 1];
 	if (bEnableMemoryProfile){
 		PROCESS_MEMORY_COUNTERS infoPMC;
 
@@ -190,349 +309,2726 @@ void Profiler1::FrameEnd()
 	QueryPerformanceCounter(&EndingTime);
 
 	frame.i64EndTime = EndingTime.QuadPart;
+
+	// functions still running are cut at the end of the frame
+	while (!m_stackFrames.empty()) {
+		EndStackFrame(frame, m_stackFrames.top().id, frame.i64EndTime, false);
+		m_stackFrames.pop();
+	}
+	m_vecCoroSegments.clear();
+
+	if (m_pLiveView) {
+		PublishLiveView(frame);
+	}
+}
+
+// bucket of the self time histogram, the bit length of the time
+static unsigned HistBucket(unsigned unTime)
+{
+	unsigned unBucket = 0;
+	while (unTime) {
+		unBucket++;
+		unTime >>= 1;
+	}
+	return (std::min)(unBucket, (unsigned)P1_HIST_BUCKETS - 1);
+}
+
+static bool CompareFunctionId(const P1_StatsAccum& sl, const P1_StatsAccum& sr) {
+	return sl.idFunc < sr.idFunc;
 }
 
 void Profiler1::Analyze()
 {
 	g_bEnableProfiler1 = false;
+	m_registry.Sync(m_modules);
 	m_vecStats.clear();
-	m_mapStats.clear();
+	m_vecFrameStats.clear();
+	m_vecCounterStats.clear();
+	m_vecPathStats.clear();
+	m_vecPathSelfTimeHist.clear();
+
+	unsigned unFunctions = m_registry.Size();
+	m_vecStats.resize(unFunctions);
+	m_vecSelfTimeHist.assign((size_t)unFunctions * P1_HIST_BUCKETS, 0);
+	for (unsigned id = 0; id < unFunctions; id++) {
+		m_vecStats[id].idFunc = id;
+	}
 	
 	// for each display frame
 	size_t szFrames = m_vecFrames.size();
 	for (size_t k = 0; k < szFrames; k++) {
 		
-		m_vecStats.push_back(std::map<DWORD64, P1_StatsUnit>());
-
-		// rebuild callstack iterativly
-		std::stack<unsigned> callStack;
-		std::vector<P1_StackFrame>& vecStackFrames = m_vecFrames[k].vecStackFrames;
-		size_t size = vecStackFrames.size();
-
-		for (size_t i = 0; i < size; i++) {
-			P1_StackFrame & rootFrame = vecStackFrames[i];
-			rootFrame.unSubTime = 0;
-			callStack.push(rootFrame.id);
-
-			for (size_t j = i + 1; j < size; j++) {
-				P1_StackFrame & frameNext = vecStackFrames[j];
-				if (frameNext.idCaller == frameNext.id) {
-					// idCaller == id means it is rootFrame
-					break;
-				} else if (frameNext.idCaller != callStack.top()) {
-
-					__int64 i64SubTimeCost = 0;
-					while(!callStack.empty()) {
-						int idTop = callStack.top();
-						if (idTop == frameNext.idCaller) {
-							vecStackFrames[idTop].unSubTime += (unsigned)i64SubTimeCost;
-							break;
-						}
-						callStack.pop();
-
-						__int64 i64LocalTimeCost = 0;
-						i64LocalTimeCost = vecStackFrames[idTop].i64EndTime - vecStackFrames[idTop].i64StartTime;
-
-						i64LocalTimeCost *= 1000000;
-						i64LocalTimeCost /= i64Frequency;
-						vecStackFrames[idTop].unTotalTime = (unsigned)i64LocalTimeCost;
-						vecStackFrames[idTop].unSubTime += (unsigned)i64SubTimeCost;
-						vecStackFrames[idTop].unSelfTime = (unsigned)(i64LocalTimeCost - vecStackFrames[idTop].unSubTime);
-						i64SubTimeCost = i64LocalTimeCost;
-
-						StatsCall(k, vecStackFrames[idTop]);
-					}
-				}
-				frameNext.unSubTime = 0;
-				callStack.push(frameNext.id);
-				i++;
+		m_vecFrameStats.push_back(std::vector<P1_StatsAccum>());
+		std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[k];
+		m_vecCounterStats.push_back(std::map<DWORD64, P1_CounterStats>());
+
+		// aggregate counters of this frame
+		std::vector<P1_Event>& vecEvents = m_vecFrames[k].vecEvents;
+		std::map<DWORD64, P1_CounterStats>& counters = m_vecCounterStats[k];
+		for (size_t i = 0; i < vecEvents.size(); i++) {
+			if (vecEvents[i].bMarker) {
+				continue;
 			}
+			StatsCounter(counters, vecEvents[i]);
+		}
 
-			__int64 i64SubTimeCost = 0;
+		P1_FrameData& frame = m_vecFrames[k];
+		AnalyzeFrame(frame, vecRow);
 
-			while(!callStack.empty()) {
-				int idTop = callStack.top();
-				callStack.pop();
+		// add the frame to the statistic of the whole capture
+		for (size_t i = 0; i < vecRow.size(); i++) {
+			m_vecStats[vecRow[i].idFunc].Merge(vecRow[i]);
+		}
+		std::sort(vecRow.begin(), vecRow.end(), CompareFunctionId);
 
-				__int64 i64LocalTimeCost = 0;
-				i64LocalTimeCost = vecStackFrames[idTop].i64EndTime - vecStackFrames[idTop].i64StartTime;
+		// and every stack frame to its call path, a path never runs twice at a time.
+		// the self time histograms are only kept for the whole capture
+		for (size_t p = m_vecPathStats.size(); p < m_vecPaths.size(); p++) {
+			m_vecPathStats.push_back(P1_StatsAccum());
+			m_vecPathStats[p].idFunc = m_vecPaths[p].idFunc;
+		}
+		m_vecPathSelfTimeHist.resize(m_vecPathStats.size() * P1_HIST_BUCKETS, 0);
+		P1_StackFrameArrays& stackFrames = frame.stackFrames;
+		for (size_t i = 0; i < stackFrames.size(); i++) {
+			unsigned idPath = stackFrames.vecPathIds[i];
+			P1_StatsAccum& path = m_vecPathStats[idPath];
+			unsigned unBucket = HistBucket(stackFrames.vecSelfTime[i]);
+			path.unInvokeTimes++;
+			path.unTotalSelfTime += stackFrames.vecSelfTime[i];
+			path.unTotalTime += stackFrames.vecTotalTime[i];
+			path.nTotalMem += (int)(stackFrames.vecEndMem[i] - stackFrames.vecStartMem[i]);
+			m_vecPathSelfTimeHist[(size_t)idPath * P1_HIST_BUCKETS + unBucket]++;
+			m_vecSelfTimeHist[(size_t)stackFrames.vecFuncIds[i] * P1_HIST_BUCKETS + unBucket]++;
+		}
 
-				i64LocalTimeCost *= 1000000;
-				i64LocalTimeCost /= i64Frequency;
-				vecStackFrames[idTop].unTotalTime = (unsigned)i64LocalTimeCost;
-				vecStackFrames[idTop].unSubTime += (unsigned)i64SubTimeCost;
-				vecStackFrames[idTop].unSelfTime = (unsigned)(i64LocalTimeCost - vecStackFrames[idTop].unSubTime);
-				i64SubTimeCost = i64LocalTimeCost;
-				StatsCall(k, vecStackFrames[idTop]);
-			}
+		if (frame.unUnwoundFrames || frame.unOrphanExits) {
+			std::stringstream ss;
+			ss << "#warning:Profiler1::Analyze: frame " << frame.id << ": "
+			<< frame.unUnwoundFrames << " stack frames unwound without exit, "
+			<< frame.unOrphanExits << " exits without stack frame" << std::endl;
+			m_vecMsgs.push_back(ss.str());
 		}
 	}
+
+	AnalyzeFlows();
+	AnalyzeOutliers();
+}
+
+static bool CompareFlowEvent(const P1_FlowEvent& el, const P1_FlowEvent& er) {
+	if (el.i64Time != er.i64Time) {
+		return el.i64Time < er.i64Time;
+	}
+	return el.phase < er.phase;
 }
 
+static bool CompareRunTime(const P1_FlowStats& sl, const P1_FlowStats& sr) {
+	return sl.i64TotalRunTime > sr.i64TotalRunTime;
+}
 
-void Profiler1::StatsCall(unsigned unFrame, P1_StackFrame& frame)
+unsigned Profiler1::FindFrame(__int64 i64Time)
 {
-	std::map<DWORD64, P1_StatsUnit>::iterator it = m_mapStats.find(frame.dwAddr);
-	if (it != m_mapStats.end()) {
-		it->second.unInvokeTimes++;
-		it->second.unTotalSlefTime += frame.unSelfTime;
-		it->second.unTotalTime += frame.unTotalTime;
-		it->second.nTotalMem += (int)(frame.unEndMem - frame.unStartMem);
-	} else {
-		P1_StatsUnit unit;
-		unit.dwAddr = frame.dwAddr;
-		unit.unInvokeTimes = 1;
-		unit.unTotalSlefTime = frame.unSelfTime;
-		unit.unTotalTime = frame.unTotalTime;
-		unit.nTotalMem = (frame.unEndMem - frame.unStartMem);
-		unit.strName = GetFunctionName(frame.dwAddr);
-		m_mapStats[frame.dwAddr] = unit;
+	// frames are in time order, find the last one started before the time
+	size_t szLow = 0;
+	size_t szHigh = m_vecFrames.size();
+	while (szLow < szHigh) {
+		size_t szMid = (szLow + szHigh) / 2;
+		if (m_vecFrames[szMid].i64StartTime <= i64Time) {
+			szLow = szMid + 1;
+		} else {
+			szHigh = szMid;
+		}
+	}
+	if (szLow == 0 || m_vecFrames[szLow - 1].i64EndTime < i64Time) {
+		return P1_INVALID_ID;
 	}
+	return m_vecFrames[szLow - 1].id;
+}
 
-	if (unFrame >= m_vecStats.size()) {
-		return;
+void Profiler1::AnalyzeFlows()
+{
+	m_vecFlows.clear();
+	m_vecFlowStats.clear();
+
+	// steps recorded by every thread in this capture, in time order
+	std::vector<P1_FlowEvent> vecEvents;
+	unsigned unEpoch = m_unFlowEpoch;
+	EnterCriticalSection(&m_csFlows);
+	for (size_t i = 0; i < m_vecFlowBuffers.size(); i++) {
+		P1_FlowBuffer& buffer = *m_vecFlowBuffers[i];
+		EnterCriticalSection(&buffer.cs);
+		if (buffer.unEpoch == unEpoch) {
+			vecEvents.insert(vecEvents.end(), buffer.vecEvents.begin(), buffer.vecEvents.end());
+		}
+		LeaveCriticalSection(&buffer.cs);
+	}
+	LeaveCriticalSection(&m_csFlows);
+	std::stable_sort(vecEvents.begin(), vecEvents.end(), CompareFlowEvent);
+
+	// link the steps of each task, a flow id may be used again once its task ended.
+	// a task submitted outside the target thread's stack belongs to the task
+	// running on the submitting thread, if any
+	double dTickToUs = 1000000.0 / i64Frequency;
+	std::unordered_map<DWORD64, unsigned> mapOpenFlows;
+	std::unordered_map<DWORD, std::vector<unsigned>> mapRunningFlows;	// by worker thread, innermost last
+	for (size_t i = 0; i < vecEvents.size(); i++) {
+		P1_FlowEvent& event = vecEvents[i];
+		std::unordered_map<DWORD64, unsigned>::iterator it = mapOpenFlows.find(event.dwFlow);
+
+		if (event.phase == P1_FLOW_PHASE_SUBMIT) {
+			P1_Flow flow;
+			flow.dwFlow = event.dwFlow;
+			if (event.pDesc) {
+				if (!event.pDesc->bRegistered) {
+					RegisterZone(*event.pDesc);
+				}
+				flow.dwId = event.pDesc->dwAddr;
+			}
+			flow.dwSubmitThread = event.dwThreadId;
+			flow.i64SubmitTime = event.i64Time;
+			flow.idFrame = event.idFrame;
+			if (event.idFrame < m_vecFrames.size() && event.idStackFrame != P1_NO_STACKFRAME) {
+				P1_StackFrameArrays& stackFrames = m_vecFrames[event.idFrame].stackFrames;
+				if (event.idStackFrame < stackFrames.vecPathIds.size()) {
+					flow.idPath = stackFrames.vecPathIds[event.idStackFrame];
+				}
+			}
+			std::vector<unsigned>& vecRunning = mapRunningFlows[event.dwThreadId];
+			if (!vecRunning.empty()) {
+				P1_Flow& parent = m_vecFlows[vecRunning.back()];
+				flow.idParent = vecRunning.back();
+				if (flow.idPath == P1_INVALID_ID) {
+					flow.idPath = parent.idPath;
+				}
+				if (flow.idFrame == P1_INVALID_ID) {
+					flow.idFrame = parent.idFrame;
+				}
+			}
+			if (flow.idFrame == P1_INVALID_ID) {
+				flow.idFrame = FindFrame(event.i64Time);
+			}
+			mapOpenFlows[event.dwFlow] = (unsigned)m_vecFlows.size();
+			m_vecFlows.push_back(flow);
+		} else if (event.phase == P1_FLOW_PHASE_BEGIN) {
+			if (it == mapOpenFlows.end() || m_vecFlows[it->second].i64BeginTime) {
+				// begun without a submit
+				P1_Flow flow;
+				flow.dwFlow = event.dwFlow;
+				mapOpenFlows[event.dwFlow] = (unsigned)m_vecFlows.size();
+				m_vecFlows.push_back(flow);
+				it = mapOpenFlows.find(event.dwFlow);
+			}
+			P1_Flow& flow = m_vecFlows[it->second];
+			flow.dwWorkerThread = event.dwThreadId;
+			flow.i64BeginTime = event.i64Time;
+			if (flow.i64SubmitTime) {
+				flow.unQueueTime = (unsigned)((flow.i64BeginTime - flow.i64SubmitTime) * dTickToUs);
+			}
+			mapRunningFlows[event.dwThreadId].push_back(it->second);
+		} else {
+			if (it == mapOpenFlows.end() || !m_vecFlows[it->second].i64BeginTime) {
+				// ended without a begin
+				continue;
+			}
+			P1_Flow& flow = m_vecFlows[it->second];
+			flow.i64EndTime = event.i64Time;
+			flow.unRunTime = (unsigned)((flow.i64EndTime - flow.i64BeginTime) * dTickToUs);
+			std::vector<unsigned>& vecRunning = mapRunningFlows[flow.dwWorkerThread];
+			std::vector<unsigned>::reverse_iterator itRunning = std::find(vecRunning.rbegin(), vecRunning.rend(), it->second);
+			if (itRunning != vecRunning.rend()) {
+				vecRunning.erase(itRunning.base() - 1);
+			}
+			mapOpenFlows.erase(it);
+		}
 	}
-	std::map<DWORD64, P1_StatsUnit>& stats = m_vecStats[unFrame];
 
-	it = stats.find(frame.dwAddr);
-	if (it != stats.end()) {
-		it->second.unInvokeTimes++;
-		it->second.unTotalSlefTime += frame.unSelfTime;
-		it->second.unTotalTime += frame.unTotalTime;
-		it->second.nTotalMem += (int)(frame.unEndMem - frame.unStartMem);
-	} else {
-		P1_StatsUnit unit;
-		unit.dwAddr = frame.dwAddr;
-		unit.unInvokeTimes = 1;
-		unit.unTotalSlefTime = frame.unSelfTime;
-		unit.unTotalTime = frame.unTotalTime;
-		unit.nTotalMem = (int)(frame.unEndMem - frame.unStartMem);
-		unit.strName = GetFunctionName(frame.dwAddr);
-		stats[frame.dwAddr] = unit;
+	// the tasks of each submitting path
+	std::unordered_map<unsigned, size_t> mapStats;
+	for (size_t f = 0; f < m_vecFlows.size(); f++) {
+		P1_Flow& flow = m_vecFlows[f];
+		std::unordered_map<unsigned, size_t>::iterator it = mapStats.find(flow.idPath);
+		if (it == mapStats.end()) {
+			it = mapStats.insert(std::make_pair(flow.idPath, m_vecFlowStats.size())).first;
+			m_vecFlowStats.push_back(P1_FlowStats());
+			m_vecFlowStats.back().idPath = flow.idPath;
+		}
+		P1_FlowStats& stats = m_vecFlowStats[it->second];
+		stats.unTasks++;
+		stats.i64TotalQueueTime += flow.unQueueTime;
+		stats.i64TotalRunTime += flow.unRunTime;
+		stats.unMaxQueueTime = (std::max)(stats.unMaxQueueTime, flow.unQueueTime);
 	}
+	std::sort(m_vecFlowStats.begin(), m_vecFlowStats.end(), CompareRunTime);
 }
 
-bool cmp(P1_StatsUnit& sl, P1_StatsUnit& sr) {
-	return sl.unTotalSlefTime > sr.unTotalSlefTime;
+unsigned Profiler1::GetFrameTime(const P1_FrameInfo& frame)
+{
+	return (unsigned)((frame.i64EndTime - frame.i64StartTime) * 1000000 / i64Frequency);
 }
 
-std::vector<P1_StatsUnit> Profiler1::GetStatistic()
+size_t Profiler1::GetFramePaths(unsigned unFrame)
 {
-	std::vector<P1_StatsUnit> vecStats;
-	std::map<DWORD64, P1_StatsUnit>::iterator it = m_mapStats.begin();
-	for (; it != m_mapStats.end(); it++) {
-		vecStats.push_back(it->second);
+	m_vecFramePaths.clear();
+	if (m_vecPathRows.size() < m_vecPaths.size()) {
+		m_vecPathRows.resize(m_vecPaths.size(), P1_INVALID_ID);
 	}
+	P1_StackFrameArrays& stackFrames = m_vecFrames[unFrame].stackFrames;
+	for (size_t i = 0; i < stackFrames.vecPathIds.size(); i++) {
+		unsigned idPath = stackFrames.vecPathIds[i];
+		unsigned& unRow = m_vecPathRows[idPath];
+		if (unRow == P1_INVALID_ID) {
+			unRow = m_vecFramePaths.size();
+			m_vecFramePaths.push_back(P1_OutlierPath());
+			m_vecFramePaths.back().idPath = idPath;
+		}
+		m_vecFramePaths[unRow].unSelfTime += stackFrames.vecSelfTime[i];
+		m_vecFramePaths[unRow].unInvokeTimes++;
+	}
+	for (size_t i = 0; i < m_vecFramePaths.size(); i++) {
+		m_vecPathRows[m_vecFramePaths[i].idPath] = P1_INVALID_ID;
+	}
+	return m_vecFramePaths.size();
+}
 
-	std::sort(vecStats.begin(), vecStats.end(), cmp);
-
-	return vecStats;
+// nearest rank of the percentile among szCount sorted values, 1 based
+static size_t PercentileRank(double dPercentile, size_t szCount)
+{
+	double dRank = dPercentile / 100 * szCount;
+	size_t szRank = (size_t)dRank;
+	if (szRank < dRank) {
+		szRank++;
+	}
+	return (std::max)((size_t)1, (std::min)(szRank, szCount));
 }
 
-std::vector<P1_StatsUnit> Profiler1::GetStatistic(unsigned unFrame)
+// median of samples taken from szSamples frames, the frames without a sample count as 0
+static unsigned MedianWithZeros(std::vector<unsigned>& vecSamples, size_t szSamples)
 {
-	if (unFrame >= m_vecStats.size()) {
-		return std::vector<P1_StatsUnit>();
+	size_t szMedian = szSamples / 2;
+	size_t szZeros = szSamples - vecSamples.size();
+	if (szMedian < szZeros) {
+		return 0;
 	}
-	std::map<DWORD64, P1_StatsUnit>& stats = m_vecStats[unFrame];
-	std::vector<P1_StatsUnit> vecStats;
-	std::map<DWORD64, P1_StatsUnit>::iterator it = stats.begin();
-	for (; it != stats.end(); it++) {
-		vecStats.push_back(it->second);
+	std::nth_element(vecSamples.begin(), vecSamples.begin() + (szMedian - szZeros), vecSamples.end());
+	return vecSamples[szMedian - szZeros];
+}
+
+void Profiler1::AnalyzeOutliers()
+{
+	m_vecOutlierFrames.clear();
+	m_vecPathBaseline.assign(m_vecPaths.size(), 0);
+	m_vecFunctionBaseline.assign(m_registry.Size(), 0);
+	m_unBaselineFrameTime = 0;
+	size_t szFrames = m_vecFrames.size();
+	if (szFrames == 0) {
+		return;
 	}
 
-	std::sort(vecStats.begin(), vecStats.end(), cmp);
+	// median and percentile of the frame times, without sorting all of them
+	std::vector<unsigned> vecTimes(szFrames);
+	for (size_t k = 0; k < szFrames; k++) {
+		vecTimes[k] = GetFrameTime(m_vecFrames[k]);
+	}
+	std::vector<unsigned> vecOrder = vecTimes;
+	std::nth_element(vecOrder.begin(), vecOrder.begin() + szFrames / 2, vecOrder.end());
+	m_unBaselineFrameTime = vecOrder[szFrames / 2];
+	size_t szPercentile = PercentileRank(dOutlierPercentile, szFrames);
+	std::nth_element(vecOrder.begin(), vecOrder.begin() + szPercentile - 1, vecOrder.end());
+	unsigned unThreshold = vecOrder[szPercentile - 1];
+
+	// with few frames the percentile is the slowest frame, so also take the frames far
+	// over the median, in scaled median absolute deviations. The deviation is at least
+	// 5% of the median: steady captures have a MAD of a few us, and their jitter is not slow
+	for (size_t k = 0; k < szFrames; k++) {
+		vecOrder[k] = vecTimes[k] > m_unBaselineFrameTime ? vecTimes[k] - m_unBaselineFrameTime : m_unBaselineFrameTime - vecTimes[k];
+	}
+	std::nth_element(vecOrder.begin(), vecOrder.begin() + szFrames / 2, vecOrder.end());
+	double dDeviation = (std::max)(1.4826 * vecOrder[szFrames / 2], 0.05 * m_unBaselineFrameTime);
+	double dMADThreshold = m_unBaselineFrameTime + dOutlierMADs * dDeviation;
+	for (size_t k = 0; k < szFrames; k++) {
+		if (vecTimes[k] > unThreshold || vecTimes[k] > dMADThreshold) {
+			m_vecOutlierFrames.push_back((unsigned)k);
+		}
+	}
 
-	return vecStats;
+	// a function called from several paths can be slow in total while each of its
+	// paths stays under its own baseline, so both get one
+	GetBaselines(std::vector<unsigned>(), std::vector<unsigned>(), m_vecFunctionBaseline, m_vecPathBaseline);
 }
 
-bool Profiler1::WriteStatistic(const char * filename)
+void Profiler1::GetFrameGroups(unsigned unFrame, const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+	std::vector<P1_OutlierFunction>& vecFunctions, std::vector<P1_OutlierPath>& vecPaths)
 {
-	std::vector<P1_StatsUnit> vecStats = GetStatistic();
-	return WriteStatistic(vecStats, filename);
+	vecFunctions.clear();
+	vecPaths.clear();
+	std::unordered_map<unsigned, size_t> mapRows;	// group to row
+	std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[unFrame];
+	for (size_t i = 0; i < vecRow.size(); i++) {
+		unsigned idGroup = vecRow[i].idFunc;
+		if (!vecFuncGroups.empty()) {
+			idGroup = idGroup < vecFuncGroups.size() ? vecFuncGroups[idGroup] : P1_INVALID_ID;
+		}
+		if (idGroup == P1_INVALID_ID) {
+			continue;
+		}
+		std::unordered_map<unsigned, size_t>::iterator it = mapRows.find(idGroup);
+		if (it == mapRows.end()) {
+			it = mapRows.insert(std::make_pair(idGroup, vecFunctions.size())).first;
+			vecFunctions.push_back(P1_OutlierFunction());
+			vecFunctions.back().idFunc = idGroup;
+		}
+		vecFunctions[it->second].unSelfTime += vecRow[i].unTotalSelfTime;
+		vecFunctions[it->second].unInvokeTimes += vecRow[i].unInvokeTimes;
+	}
+
+	// the path table of a frame is only built when asked for
+	GetFramePaths(unFrame);
+	if (vecPathGroups.empty()) {
+		vecPaths = m_vecFramePaths;
+		return;
+	}
+	mapRows.clear();
+	for (size_t i = 0; i < m_vecFramePaths.size(); i++) {
+		unsigned idPath = m_vecFramePaths[i].idPath;
+		unsigned idGroup = idPath < vecPathGroups.size() ? vecPathGroups[idPath] : P1_INVALID_ID;
+		if (idGroup == P1_INVALID_ID) {
+			continue;
+		}
+		std::unordered_map<unsigned, size_t>::iterator it = mapRows.find(idGroup);
+		if (it == mapRows.end()) {
+			it = mapRows.insert(std::make_pair(idGroup, vecPaths.size())).first;
+			vecPaths.push_back(P1_OutlierPath());
+			vecPaths.back().idPath = idGroup;
+		}
+		vecPaths[it->second].unSelfTime += m_vecFramePaths[i].unSelfTime;
+		vecPaths[it->second].unInvokeTimes += m_vecFramePaths[i].unInvokeTimes;
+	}
 }
 
-bool Profiler1::WriteStatistic(const char * filename, unsigned unFrame)
+void Profiler1::GetBaselines(const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+	std::vector<unsigned>& vecFuncBaseline, std::vector<unsigned>& vecPathBaseline)
 {
-	std::vector<P1_StatsUnit> vecStats = GetStatistic(unFrame);
-	return WriteStatistic(vecStats, filename);
+	// median self time over evenly sampled frames, a frame without the function or
+	// path counts as 0
+	size_t szFrames = m_vecFrameStats.size();
+	size_t szStep = (std::max)((size_t)1, szFrames / P1_OUTLIER_SAMPLES);
+	size_t szSamples = 0;
+	std::vector<std::vector<unsigned>> vecFuncSamples(vecFuncBaseline.size());
+	std::vector<std::vector<unsigned>> vecPathSamples(vecPathBaseline.size());
+	std::vector<P1_OutlierFunction> vecFunctions;
+	std::vector<P1_OutlierPath> vecPaths;
+	for (size_t k = 0; k < szFrames; k += szStep) {
+		GetFrameGroups((unsigned)k, vecFuncGroups, vecPathGroups, vecFunctions, vecPaths);
+		for (size_t i = 0; i < vecFunctions.size(); i++) {
+			if (vecFunctions[i].idFunc < vecFuncSamples.size()) {
+				vecFuncSamples[vecFunctions[i].idFunc].push_back(vecFunctions[i].unSelfTime);
+			}
+		}
+		for (size_t i = 0; i < vecPaths.size(); i++) {
+			if (vecPaths[i].idPath < vecPathSamples.size()) {
+				vecPathSamples[vecPaths[i].idPath].push_back(vecPaths[i].unSelfTime);
+			}
+		}
+		szSamples++;
+	}
+	for (size_t f = 0; f < vecFuncSamples.size(); f++) {
+		vecFuncBaseline[f] = MedianWithZeros(vecFuncSamples[f], szSamples);
+	}
+	for (size_t p = 0; p < vecPathSamples.size(); p++) {
+		vecPathBaseline[p] = MedianWithZeros(vecPathSamples[p], szSamples);
+	}
 }
 
-bool Profiler1::WriteStatistic(std::vector<P1_StatsUnit>& vecStats, const char * filename)
+void Profiler1::AnalyzeFrame(P1_FrameData& frame, std::vector<P1_StatsAccum>& vecRow, bool bInternPaths)
 {
-	std::ofstream ostrm(filename, std::ofstream::trunc);
-	ostrm << "\"Address\",\"Name\",\"AvgSelfTime(us)\",\"AvgTime(us)\",\"AvgMemory(bytes)\",\"TotalSelfTime(us)\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\"\n";
-    std::ios_base::fmtflags ff, fn;
-	ff = ostrm.flags();
-	fn = ff;
-  	fn &= ~std::cout.basefield;   // unset basefield bits
-	fn |= std::ios::hex;
-	fn |= std::ios::showbase;
-	fn |= std::ios::uppercase;
+	// functions may have been registered since the last frame
+	unsigned unFunctions = m_registry.Size();
+	if (m_vecActiveCalls.size() < unFunctions) {
+		m_vecActiveCalls.resize(unFunctions, 0);
+		m_vecFrameRows.resize(unFunctions, P1_INVALID_ID);
+	}
 
-	for (std::vector<P1_StatsUnit>::iterator it = vecStats.begin(); it != vecStats.end(); it++) {
-		ostrm.flags(fn);
-		ostrm << "\"" << it->dwAddr;
-		ostrm.flags(ff);
-		ostrm << "\",\"" << it->strName << "\",\"" 
-			<< it->unTotalSlefTime / it->unInvokeTimes << "\",\"" 
-			<< it->unTotalTime / it->unInvokeTimes << "\",\"" 
-			<< (int)(it->nTotalMem / it->unInvokeTimes) << "\",\""
-			<< it->unTotalSlefTime << "\",\"" 
-			<< it->unTotalTime << "\",\""
-			<< it->nTotalMem << "\",\""
-			<< it->unInvokeTimes << "\"\n";
+	P1_StackFrameArrays& stackFrames = frame.stackFrames;
+	size_t size = stackFrames.size();
+	stackFrames.vecTotalTime.resize(size);
+	stackFrames.vecSubTime.assign(size, 0);
+	stackFrames.vecSelfTime.resize(size);
+	stackFrames.vecRecursionDepth.resize(size);
+	stackFrames.vecPathIds.resize(size);
+
+	// time of every stack frame, minus the time of its callees
+	P1_ComputeTotalTime(stackFrames.vecStartTime.data(), stackFrames.vecEndTime.data(), size,
+		1000000.0 / i64Frequency, stackFrames.vecTotalTime.data());
+	for (size_t i = 0; i < size; i++) {
+		unsigned idCaller = stackFrames.vecCallerIds[i];
+		if (idCaller != i) {
+			stackFrames.vecSubTime[idCaller] += stackFrames.vecTotalTime[i];
+		}
+	}
+	P1_ComputeSelfTime(stackFrames.vecTotalTime.data(), stackFrames.vecSubTime.data(), size,
+		stackFrames.vecSelfTime.data());
+
+	// rebuild callstack iterativly, to find out recursive calls
+	std::stack<unsigned> callStack;
+	for (size_t i = 0; i < size; i++) {
+		unsigned idCaller = stackFrames.vecCallerIds[i];
+
+		// stack frames are in order of start time, so every running frame
+		// which is not the caller of the next one has ended.
+		// idCaller == id means it is rootFrame, it ends all of them
+		while (!callStack.empty() && callStack.top() != idCaller) {
+			m_vecActiveCalls[stackFrames.vecFuncIds[callStack.top()]]--;
+			callStack.pop();
+		}
+		stackFrames.vecRecursionDepth[i] = ++m_vecActiveCalls[stackFrames.vecFuncIds[i]];
+		callStack.push((unsigned)i);
+		if (bInternPaths) {
+			stackFrames.vecPathIds[i] = InternPath(idCaller != i ? stackFrames.vecPathIds[idCaller] : P1_INVALID_ID,
+				stackFrames.vecFuncIds[i]);
+		}
+
+		StatsCall(vecRow, stackFrames, (unsigned)i);
+	}
+
+	while(!callStack.empty()) {
+		m_vecActiveCalls[stackFrames.vecFuncIds[callStack.top()]]--;
+		callStack.pop();
+	}
+
+	for (size_t i = 0; i < vecRow.size(); i++) {
+		m_vecFrameRows[vecRow[i].idFunc] = P1_INVALID_ID;
 	}
-	ostrm.close();
-	return true;
 }
 
-bool Profiler1::WriteFrameStatistic(const char * filename)
+void Profiler1::StatsCall(std::vector<P1_StatsAccum>& vecRow, P1_StackFrameArrays& stackFrames, unsigned idFrame)
 {
-	std::ofstream ostrm(filename);
-	ostrm << "\"Frame\",\"StartTime\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\"\n";
-
-	for (std::vector<P1_Frame>::iterator it = m_vecFrames.begin(); it != m_vecFrames.end(); it++) {
-		__int64 i64LocalTimeCost = 0;
-		i64LocalTimeCost = it->i64EndTime - it->i64StartTime;
-		i64LocalTimeCost *= 1000000;
-		i64LocalTimeCost /= i64Frequency;
+	unsigned idFunc = stackFrames.vecFuncIds[idFrame];
+	unsigned& unRow = m_vecFrameRows[idFunc];
+	if (unRow == P1_INVALID_ID) {
+		unRow = vecRow.size();
+		vecRow.push_back(P1_StatsAccum());
+		vecRow.back().idFunc = idFunc;
+	}
+	P1_StatsAccum& unit = vecRow[unRow];
+	unsigned unRecursionDepth = stackFrames.vecRecursionDepth[idFrame];
 
-		__int64 i64TimeStart = 0;
-		i64TimeStart = it->i64StartTime - i64StartTime;
-		i64TimeStart *= 1000000;
-		i64TimeStart /= i64Frequency;
+	unit.unInvokeTimes++;
+	unit.unTotalSelfTime += stackFrames.vecSelfTime[idFrame];
+	unit.unMaxRecursionDepth = (std::max)(unit.unMaxRecursionDepth, unRecursionDepth);
 
-		ostrm << "\"" << it->id << "\",\"" 
-			<< i64TimeStart << "\",\"" 
-			<< i64LocalTimeCost << "\",\""
-			<< it->unEndMem - it->unStartMem << "\",\""
-			<< it->vecStackFrames.size() << "\"\n";
+	// time and memory of a recursive call are already in its outermost call
+	if (unRecursionDepth > 1) {
+		unit.unRecursiveInvokeTimes++;
+	} else {
+		unit.unTotalTime += stackFrames.vecTotalTime[idFrame];
+		unit.nTotalMem += (int)(stackFrames.vecEndMem[idFrame] - stackFrames.vecStartMem[idFrame]);
 	}
-	ostrm.close();
-	return true;
 }
 
-
-std::vector<P1_Frame> Profiler1::GetFrames()
+// scalar versions, also used for the remainder of the vectorized loops
+static void ComputeTotalTimeScalar(const __int64 * pStartTime, const __int64 * pEndTime, size_t szCount,
+	double dTickToUs, unsigned * pTotalTime)
 {
-	return m_vecFrames;
+	for (size_t i = 0; i < szCount; i++) {
+		__int64 i64Ticks = pEndTime[i] - pStartTime[i];
+		pTotalTime[i] = i64Ticks > 0 ? (unsigned)((std::min)(i64Ticks * dTickToUs, 2147483647.0)) : 0;
+	}
 }
 
-void Profiler1::SetTargetThread(DWORD dwThreadId)
+static void ComputeSelfTimeScalar(const unsigned * pTotalTime, const unsigned * pSubTime, size_t szCount,
+	unsigned * pSelfTime)
 {
-	dwTargetThread = dwThreadId;
+	for (size_t i = 0; i < szCount; i++) {
+		pSelfTime[i] = pTotalTime[i] > pSubTime[i] ? pTotalTime[i] - pSubTime[i] : 0;
+	}
 }
 
-Profiler1* Profiler1::s_pInstance = new Profiler1;
-Profiler1::GC Profiler1::gc;
-Profiler1* s_pProfiler1 = g_objProfiler1.GetInstancePtr();
-
-void _stdcall EnterFunc(unsigned* pStack)
+#ifdef P1_SIMD_AVX2
+static bool HasAVX2()
 {
-	if (GetCurrentThreadId() != s_pProfiler1->dwTargetThread) {
-		return;
+	int arrInfo[4];
+	__cpuid(arrInfo, 0);
+	if (arrInfo[0] < 7) {
+		return false;
 	}
-	size_t szFrame = s_pProfiler1->m_vecFrames.size();
-	if (szFrame <= 0) {
-		return;
+	__cpuid(arrInfo, 1);
+	bool bOSXSave = (arrInfo[2] & (1 << 27)) != 0;
+	bool bAVX = (arrInfo[2] & (1 << 28)) != 0;
+	if (!bOSXSave || !bAVX || (_xgetbv(0) & 6) != 6) {
+		return false;
 	}
+	__cpuidex(arrInfo, 7, 0);
+	return (arrInfo[1] & (1 << 5)) != 0;
+}
+static const bool s_bHasAVX2 = HasAVX2();
+#endif
 
-	void* pCaller = (void*)(pStack[0] - 5);
-
-	P1_Frame& frame = s_pProfiler1->m_vecFrames[szFrame - 1];
+void P1_ComputeTotalTime(const __int64 * pStartTime, const __int64 * pEndTime, size_t szCount,
+	double dTickToUs, unsigned * pTotalTime)
+{
+	size_t i = 0;
+#if defined(P1_SIMD_AVX2)
+	if (s_bHasAVX2) {
+		// ticks below 2^52 are converted to double exactly by adding the exponent of 2^52
+		const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+		const __m256d magicd = _mm256_castsi256_pd(magic);
+		const __m256d scale = _mm256_set1_pd(dTickToUs);
+		const __m256d limit = _mm256_set1_pd(2147483647.0);
+		const __m256i zero = _mm256_setzero_si256();
+		for (; i + 4 <= szCount; i += 4) {
+			__m256i start = _mm256_loadu_si256((const __m256i *)(pStartTime + i));
+			__m256i end = _mm256_loadu_si256((const __m256i *)(pEndTime + i));
+			__m256i ticks = _mm256_sub_epi64(end, start);
+			ticks = _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, ticks), ticks);
+			__m256d us = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(ticks, magic)), magicd);
+			us = _mm256_min_pd(_mm256_mul_pd(us, scale), limit);
+			_mm_storeu_si128((__m128i *)(pTotalTime + i), _mm256_cvttpd_epi32(us));
+		}
+	}
+#elif defined(P1_SIMD_NEON)
+	const float64x2_t scale = vdupq_n_f64(dTickToUs);
+	const float64x2_t limit = vdupq_n_f64(2147483647.0);
+	for (; i + 2 <= szCount; i += 2) {
+		int64x2_t ticks = vsubq_s64(vld1q_s64(pEndTime + i), vld1q_s64(pStartTime + i));
+		ticks = vbslq_s64(vcltzq_s64(ticks), vdupq_n_s64(0), ticks);
+		float64x2_t us = vminq_f64(vmulq_f64(vcvtq_f64_s64(ticks), scale), limit);
+		vst1_u32(pTotalTime + i, vmovn_u64(vcvtq_u64_f64(us)));
+	}
+#endif
+	ComputeTotalTimeScalar(pStartTime + i, pEndTime + i, szCount - i, dTickToUs, pTotalTime + i);
+}
 
-	P1_StackFrame stackFrame;
-	stackFrame.dwAddr = (DWORD64)pCaller;
-	stackFrame.id = frame.vecStackFrames.size();
+void P1_ComputeSelfTime(const unsigned * pTotalTime, const unsigned * pSubTime, size_t szCount,
+	unsigned * pSelfTime)
+{
+	size_t i = 0;
+#if defined(P1_SIMD_AVX2)
+	if (s_bHasAVX2) {
+		// max(total, sub) - sub, saturates at 0
+		for (; i + 8 <= szCount; i += 8) {
+			__m256i total = _mm256_loadu_si256((const __m256i *)(pTotalTime + i));
+			__m256i sub = _mm256_loadu_si256((const __m256i *)(pSubTime + i));
+			__m256i self = _mm256_sub_epi32(_mm256_max_epu32(total, sub), sub);
+			_mm256_storeu_si256((__m256i *)(pSelfTime + i), self);
+		}
+	}
+#elif defined(P1_SIMD_NEON)
+	for (; i + 4 <= szCount; i += 4) {
+		vst1q_u32(pSelfTime + i, vqsubq_u32(vld1q_u32(pTotalTime + i), vld1q_u32(pSubTime + i)));
+	}
+#endif
+	ComputeSelfTimeScalar(pTotalTime + i, pSubTime + i, szCount - i, pSelfTime + i);
+}
 
-	if (s_pProfiler1->m_stackFrames.empty()) {
-		stackFrame.idCaller = stackFrame.id;
+void Profiler1::StatsCounter(std::map<DWORD64, P1_CounterStats>& counters, P1_Event& event)
+{
+	std::map<DWORD64, P1_CounterStats>::iterator it = counters.find(event.dwId);
+	if (it != counters.end()) {
+		P1_CounterStats& stats = it->second;
+		stats.dMin = (std::min)(stats.dMin, event.dValue);
+		stats.dMax = (std::max)(stats.dMax, event.dValue);
+		stats.dTotal += event.dValue;
+		stats.dLast = event.dValue;
+		stats.unSamples++;
 	} else {
-		stackFrame.idCaller = s_pProfiler1->m_stackFrames.top();
+		P1_CounterStats stats;
+		stats.dwId = event.dwId;
+		stats.dMin = event.dValue;
+		stats.dMax = event.dValue;
+		stats.dTotal = event.dValue;
+		stats.dLast = event.dValue;
+		stats.unSamples = 1;
+		stats.strName = GetFunctionName(event.dwId);
+		counters[event.dwId] = stats;
 	}
+}
 
-	if (s_pProfiler1->bEnableMemoryProfile){
-		PROCESS_MEMORY_COUNTERS infoPMC;
+bool cmp(P1_StatsUnit& sl, P1_StatsUnit& sr) {
+	return sl.unTotalSlefTime > sr.unTotalSlefTime;
+}
 
-		GetProcessMemoryInfo(GetCurrentProcess(), &infoPMC, sizeof(infoPMC));
-		stackFrame.unStartMem = infoPMC.WorkingSetSize;
+std::vector<P1_StatsUnit> Profiler1::GetStatistic()
+{
+	return GetStatistic(m_vecStats.data(), m_vecStats.size(), m_vecSelfTimeHist.data());
+}
+
+std::vector<P1_StatsUnit> Profiler1::GetStatistic(unsigned unFrame)
+{
+	if (unFrame >= m_vecFrameStats.size()) {
+		return std::vector<P1_StatsUnit>();
 	}
+	std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[unFrame];
+	return GetStatistic(vecRow.data(), vecRow.size(), NULL);
+}
 
-	LARGE_INTEGER StartingTime;
-	QueryPerformanceCounter(&StartingTime);
+std::vector<P1_StatsUnit> Profiler1::GetStatistic(const P1_StatsAccum * pStats, size_t szStats, const unsigned * pHist)
+{
+	std::vector<P1_StatsUnit> vecStats;
+	for (size_t i = 0; i < szStats; i++) {
+		const P1_StatsAccum& accum = pStats[i];
+		if (accum.unInvokeTimes == 0) {
+			continue;
+		}
+		P1_StatsUnit unit;
+		unit.idFunc = accum.idFunc;
+		unit.dwAddr = m_registry.GetAddress(accum.idFunc);
+		unit.unTotalTime = accum.unTotalTime;
+		unit.unTotalSlefTime = accum.unTotalSelfTime;
+		unit.nTotalMem = accum.nTotalMem;
+		unit.unInvokeTimes = accum.unInvokeTimes;
+		unit.unRecursiveInvokeTimes = accum.unRecursiveInvokeTimes;
+		unit.unMaxRecursionDepth = accum.unMaxRecursionDepth;
+		if (pHist) {
+			memcpy(unit.arrSelfTimeHist, pHist + (size_t)accum.idFunc * P1_HIST_BUCKETS, sizeof(unit.arrSelfTimeHist));
+		}
+		unit.strName = GetFunctionName(unit.dwAddr);
+		vecStats.push_back(unit);
+	}
 
-	stackFrame.i64StartTime = StartingTime.QuadPart;
+	std::sort(vecStats.begin(), vecStats.end(), cmp);
 
-	frame.vecStackFrames.push_back(stackFrame);
-	s_pProfiler1->m_stackFrames.push(stackFrame.id);
+	return vecStats;
 }
 
-static __declspec(thread) bool bHooking = false;
-
-extern "C" __declspec(naked) void __cdecl _penter()
+// "std::vector<Foo>::push_back" to "std::vector<>::push_back", the < and >
+// of operator names are kept
+static std::string StripTemplateArgs(const std::string& strName)
 {
-	// prolog
-	_asm
-	{
-		pushad              // save all general purpose registers
+	std::string strStripped;
+	int nDepth = 0;
+	for (size_t i = 0; i < strName.size(); i++) {
+		char c = strName[i];
+		if (strName.compare(i, 8, "operator") == 0
+			&& (i == 0 || !(isalnum((unsigned char)strName[i - 1]) || strName[i - 1] == '_'))) {
+			size_t j = i + 8;
+			while (j < strName.size() && strchr("<>=-", strName[j])) {
+				j++;
+			}
+			if (nDepth == 0) {
+				strStripped.append(strName, i, j - i);
+			}
+			i = j - 1;
+		} else if (c == '<') {
+			if (nDepth == 0) {
+				strStripped += "<>";
+			}
+			nDepth++;
+		} else if (c == '>') {
+			if (nDepth > 0) {
+				nDepth--;
+			}
+		} else if (nDepth == 0) {
+			strStripped += c;
+		}
 	}
-	if (bHooking || !g_bEnableProfiler1) {
-		// epilog
-		_asm {
-			popad
-			ret
+	return strStripped;
+}
+
+std::string Profiler1::GetRollupName(unsigned idFunc, P1_RollupKind kind)
+{
+	DWORD64 dwAddr = m_registry.GetAddress(idFunc);
+	std::string strGroup;
+	size_t szScope = std::string::npos;
+	switch (kind) {
+	case P1_ROLLUP_TEMPLATE:
+		strGroup = StripTemplateArgs(GetFunctionName(dwAddr));
+		break;
+	case P1_ROLLUP_CLASS:
+		strGroup = StripTemplateArgs(GetFunctionName(dwAddr));
+		szScope = strGroup.rfind("::");
+		strGroup = szScope == std::string::npos ? "(global)" : strGroup.substr(0, szScope);
+		break;
+	case P1_ROLLUP_NAMESPACE:
+		// "a::f" is taken as a member of class a, only a name with two scopes or
+		// more has a namespace
+		strGroup = StripTemplateArgs(GetFunctionName(dwAddr));
+		szScope = strGroup.find("::");
+		if (szScope == std::string::npos || strGroup.find("::", szScope + 2) == std::string::npos) {
+			strGroup = "(global)";
+		} else {
+			strGroup = strGroup.substr(0, szScope);
 		}
+		break;
+	case P1_ROLLUP_FILE:
+		strGroup = GetSourceFile(dwAddr);
+		break;
+	case P1_ROLLUP_MODULE: {
+		DWORD64 dwOffset = 0;
+		strGroup = GetModuleTitle(m_registry.GetModule(idFunc, dwOffset));
+		break;
 	}
-	bHooking = true;
-	_asm {
-		mov eax, esp     // current stack pointer
-		add eax, 32      // stack pointer before pushad
-		push eax		 // return address, the address of the function
-		call EnterFunc
+	default:
+		strGroup = GetFunctionName(dwAddr);
+		break;
 	}
+	return strGroup.empty() ? "(unknown)" : strGroup;
+}
 
-	bHooking = false;
-	// epilog
-	_asm
-	{
-		popad               // restore general purpose registers
-		ret                 // start executing original function
+Profiler1::RollupIndex& Profiler1::GetRollupIndex(P1_RollupKind kind)
+{
+	// only functions registered since the last call are parsed
+	RollupIndex& index = m_arrRollups[kind];
+	unsigned unFunctions = m_registry.Size();
+	for (unsigned id = (unsigned)index.vecGroups.size(); id < unFunctions; id++) {
+		std::string strGroup = GetRollupName(id, kind);
+		std::unordered_map<std::string, unsigned>::iterator it = index.mapNames.find(strGroup);
+		if (it == index.mapNames.end()) {
+			it = index.mapNames.insert(std::make_pair(strGroup, (unsigned)index.vecNames.size())).first;
+			index.vecNames.push_back(strGroup);
+		}
+		index.vecGroups.push_back(it->second);
 	}
+	return index;
 }
 
-void _stdcall ExitFunc(unsigned* pStack)
+std::string Profiler1::GetGroupName(unsigned idFunc, P1_RollupKind kind)
 {
-	if (GetCurrentThreadId() != s_pProfiler1->dwTargetThread) {
-		return;
+	if (kind == P1_ROLLUP_FUNCTION || kind >= P1_ROLLUP_KINDS) {
+		return GetFunctionName(m_registry.GetAddress(idFunc));
 	}
+	RollupIndex& index = GetRollupIndex(kind);
+	return idFunc < index.vecGroups.size() ? index.vecNames[index.vecGroups[idFunc]] : "(unknown)";
+}
 
-	void* pCaller = (void*)(pStack[0] - 5); // the instruction for calling _penter is 5 bytes long
-
-	if (s_pProfiler1->m_stackFrames.empty()){
+std::vector<P1_StatsUnit> Profiler1::GetRollupStatistic(P1_RollupKind kind)
+{
+	return GetRollupStatistic(m_vecStats.data(), m_vecStats.size(), m_vecSelfTimeHist.data(), kind);
+}
+
+std::vector<P1_StatsUnit> Profiler1::GetRollupStatistic(P1_RollupKind kind, unsigned unFrame)
+{
+	if (unFrame >= m_vecFrameStats.size()) {
+		return std::vector<P1_StatsUnit>();
+	}
+	std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[unFrame];
+	return GetRollupStatistic(vecRow.data(), vecRow.size(), NULL, kind);
+}
+
+std::vector<P1_StatsUnit> Profiler1::GetRollupStatistic(const P1_StatsAccum * pStats, size_t szStats, const unsigned * pHist, P1_RollupKind kind)
+{
+	if (kind == P1_ROLLUP_FUNCTION || kind >= P1_ROLLUP_KINDS) {
+		return GetStatistic(pStats, szStats, pHist);
+	}
+	RollupIndex& index = GetRollupIndex(kind);
+	std::vector<P1_StatsAccum> vecGroups(index.vecNames.size());
+	std::vector<unsigned> vecGroupHist(pHist ? vecGroups.size() * P1_HIST_BUCKETS : 0, 0);
+	for (size_t i = 0; i < szStats; i++) {
+		if (pStats[i].idFunc < index.vecGroups.size()) {
+			unsigned idGroup = index.vecGroups[pStats[i].idFunc];
+			vecGroups[idGroup].Merge(pStats[i]);
+			for (int b = 0; pHist && b < P1_HIST_BUCKETS; b++) {
+				vecGroupHist[(size_t)idGroup * P1_HIST_BUCKETS + b] += pHist[(size_t)pStats[i].idFunc * P1_HIST_BUCKETS + b];
+			}
+		}
+	}
+
+	std::vector<P1_StatsUnit> vecStats;
+	for (size_t g = 0; g < vecGroups.size(); g++) {
+		const P1_StatsAccum& accum = vecGroups[g];
+		if (accum.unInvokeTimes == 0) {
+			continue;
+		}
+		P1_StatsUnit unit;
+		unit.idFunc = P1_INVALID_ID;
+		unit.unTotalTime = accum.unTotalTime;
+		unit.unTotalSlefTime = accum.unTotalSelfTime;
+		unit.nTotalMem = accum.nTotalMem;
+		unit.unInvokeTimes = accum.unInvokeTimes;
+		unit.unRecursiveInvokeTimes = accum.unRecursiveInvokeTimes;
+		unit.unMaxRecursionDepth = accum.unMaxRecursionDepth;
+		if (pHist) {
+			memcpy(unit.arrSelfTimeHist, &vecGroupHist[g * P1_HIST_BUCKETS], sizeof(unit.arrSelfTimeHist));
+		}
+		unit.strName = index.vecNames[g];
+		vecStats.push_back(unit);
+	}
+
+	std::sort(vecStats.begin(), vecStats.end(), cmp);
+
+	return vecStats;
+}
+
+P1_Series Profiler1::GetSeries(unsigned idFunc)
+{
+	size_t szFrames = m_vecFrameStats.size();
+	P1_Series series;
+	series.vecSelfTime.assign(szFrames, 0);
+	series.vecInvokeTimes.assign(szFrames, 0);
+	series.vecMemory.assign(szFrames, 0);
+
+	// rows of a frame are sorted by function id
+	P1_StatsAccum key;
+	key.idFunc = idFunc;
+	for (size_t k = 0; k < szFrames; k++) {
+		std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[k];
+		std::vector<P1_StatsAccum>::iterator it = std::lower_bound(vecRow.begin(), vecRow.end(), key, CompareFunctionId);
+		if (it != vecRow.end() && it->idFunc == idFunc) {
+			series.vecSelfTime[k] = it->unTotalSelfTime;
+			series.vecInvokeTimes[k] = it->unInvokeTimes;
+			series.vecMemory[k] = it->nTotalMem;
+		}
+	}
+	return series;
+}
+
+bool Profiler1::WriteColumnarStatistic(const char * filename, unsigned unBlockFrames, P1_RollupKind kind)
+{
+	std::ofstream ostrm(filename, std::ofstream::binary | std::ofstream::trunc);
+	if (!ostrm) {
+		return false;
+	}
+	unBlockFrames = (std::max)(unBlockFrames, 1u);
+	unsigned unFunctions = (unsigned)m_vecStats.size();
+	unsigned unFrames = (unsigned)m_vecFrameStats.size();
+
+	// every name once, functions refer to it
+	std::vector<std::string> vecNames;
+	std::unordered_map<std::string, unsigned> mapNames;
+	std::vector<P1_ColumnarFunction> vecFunctions(unFunctions);
+	for (unsigned id = 0; id < unFunctions; id++) {
+		P1_ColumnarFunction& function = vecFunctions[id];
+		function.dwAddr = m_registry.GetAddress(id);
+		DWORD64 dwOffset = 0;
+		function.idModule = m_registry.GetModule(id, dwOffset);
+		std::string strName = GetGroupName(id, kind);
+		std::unordered_map<std::string, unsigned>::iterator it = mapNames.find(strName);
+		if (it == mapNames.end()) {
+			it = mapNames.insert(std::make_pair(strName, (unsigned)vecNames.size())).first;
+			vecNames.push_back(strName);
+		}
+		function.idName = it->second;
+	}
+
+	P1_ColumnarHeader header;
+	header.dwMagic = P1_COLUMNAR_MAGIC;
+	header.dwVersion = P1_COLUMNAR_VERSION;
+	header.unFrames = unFrames;
+	header.unFunctions = unFunctions;
+	header.unNames = (unsigned)vecNames.size();
+	header.unBlockFrames = unBlockFrames;
+	ostrm.write((const char *)&header, sizeof(header));
+	for (size_t i = 0; i < vecNames.size(); i++) {
+		unsigned unLength = (unsigned)vecNames[i].size();
+		ostrm.write((const char *)&unLength, sizeof(unLength));
+		ostrm.write(vecNames[i].data(), unLength);
+	}
+	if (unFunctions) {
+		ostrm.write((const char *)&vecFunctions[0], unFunctions * sizeof(P1_ColumnarFunction));
+	}
+	for (unsigned k = 0; k < unFrames; k++) {
+		P1_FrameData& frame = m_vecFrames[k];
+		P1_ColumnarFrame info;
+		info.i64StartTime = (frame.i64StartTime - i64StartTime) * 1000000 / i64Frequency;
+		info.unTotalTime = GetFrameTime(frame);
+		info.nTotalMem = (int)(frame.unEndMem - frame.unStartMem);
+		ostrm.write((const char *)&info, sizeof(info));
+	}
+
+	// the functions called in a block of frames, then one column after another
+	std::vector<DWORD64> vecBlockOffsets;
+	std::vector<unsigned> vecEntries(unFunctions, P1_INVALID_ID);	// entry of each function in the block
+	std::vector<unsigned> vecIds;
+	std::vector<unsigned> vecColumns;
+	for (unsigned b = 0; b < unFrames; b += unBlockFrames) {
+		unsigned unCount = (std::min)(unBlockFrames, unFrames - b);
+		vecIds.clear();
+		for (unsigned k = b; k < b + unCount; k++) {
+			std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[k];
+			for (size_t i = 0; i < vecRow.size(); i++) {
+				if (vecEntries[vecRow[i].idFunc] == P1_INVALID_ID) {
+					vecEntries[vecRow[i].idFunc] = 0;
+					vecIds.push_back(vecRow[i].idFunc);
+				}
+			}
+		}
+		std::sort(vecIds.begin(), vecIds.end());
+		for (size_t e = 0; e < vecIds.size(); e++) {
+			vecEntries[vecIds[e]] = (unsigned)e;
+		}
+
+		size_t szColumn = vecIds.size() * unCount;
+		vecColumns.assign(szColumn * P1_COLUMNAR_COLUMNS, 0);
+		for (unsigned k = b; k < b + unCount; k++) {
+			std::vector<P1_StatsAccum>& vecRow = m_vecFrameStats[k];
+			for (size_t i = 0; i < vecRow.size(); i++) {
+				size_t szCell = (size_t)vecEntries[vecRow[i].idFunc] * unCount + (k - b);
+				vecColumns[szCell] = vecRow[i].unTotalSelfTime;
+				vecColumns[szColumn + szCell] = vecRow[i].unInvokeTimes;
+				vecColumns[szColumn * 2 + szCell] = (unsigned)vecRow[i].nTotalMem;
+			}
+		}
+
+		vecBlockOffsets.push_back((DWORD64)ostrm.tellp());
+		unsigned unEntries = (unsigned)vecIds.size();
+		ostrm.write((const char *)&unEntries, sizeof(unEntries));
+		if (unEntries) {
+			ostrm.write((const char *)&vecIds[0], unEntries * sizeof(unsigned));
+			ostrm.write((const char *)&vecColumns[0], vecColumns.size() * sizeof(unsigned));
+		}
+		for (size_t e = 0; e < vecIds.size(); e++) {
+			vecEntries[vecIds[e]] = P1_INVALID_ID;
+		}
+	}
+
+	DWORD64 dwIndex = (DWORD64)ostrm.tellp();
+	if (!vecBlockOffsets.empty()) {
+		ostrm.write((const char *)&vecBlockOffsets[0], vecBlockOffsets.size() * sizeof(DWORD64));
+	}
+	ostrm.write((const char *)&dwIndex, sizeof(dwIndex));
+	ostrm.close();
+	return !ostrm.fail();
+}
+
+std::vector<P1_CounterStats> Profiler1::GetCounterStatistic(unsigned unFrame)
+{
+	std::vector<P1_CounterStats> vecCounters;
+	if (unFrame >= m_vecCounterStats.size()) {
+		return vecCounters;
+	}
+	std::map<DWORD64, P1_CounterStats>& counters = m_vecCounterStats[unFrame];
+	std::map<DWORD64, P1_CounterStats>::iterator it = counters.begin();
+	for (; it != counters.end(); it++) {
+		vecCounters.push_back(it->second);
+	}
+	return vecCounters;
+}
+
+bool Profiler1::WriteStatistic(const char * filename)
+{
+	std::vector<P1_StatsUnit> vecStats = GetStatistic();
+	return WriteStatistic(vecStats, filename);
+}
+
+bool Profiler1::WriteStatistic(const char * filename, unsigned unFrame)
+{
+	std::vector<P1_StatsUnit> vecStats = GetStatistic(unFrame);
+	return WriteStatistic(vecStats, filename);
+}
+
+bool Profiler1::WriteRollupStatistic(const char * filename, P1_RollupKind kind)
+{
+	std::vector<P1_StatsUnit> vecStats = GetRollupStatistic(kind);
+	return WriteStatistic(vecStats, filename);
+}
+
+bool Profiler1::WriteRollupStatistic(const char * filename, P1_RollupKind kind, unsigned unFrame)
+{
+	std::vector<P1_StatsUnit> vecStats = GetRollupStatistic(kind, unFrame);
+	return WriteStatistic(vecStats, filename);
+}
+
+// histogram as space separated counts, trailing empty buckets omitted
+static void WriteHistogram(std::ostream& ostrm, const unsigned * pHist)
+{
+	int nBuckets = P1_HIST_BUCKETS;
+	while (nBuckets > 0 && pHist[nBuckets - 1] == 0) {
+		nBuckets--;
+	}
+	for (int b = 0; b < nBuckets; b++) {
+		ostrm << (b ? " " : "") << pHist[b];
+	}
+}
+
+bool Profiler1::WriteStatistic(std::vector<P1_StatsUnit>& vecStats, const char * filename)
+{
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	ostrm << "\"Address\",\"Name\",\"AvgSelfTime(us)\",\"AvgTime(us)\",\"AvgMemory(bytes)\",\"TotalSelfTime(us)\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\",\"RecursiveInvokeTimes\",\"MaxRecursionDepth\",\"SelfTimeHistogram\",\"Module\",\"Offset\",\"TimeStamp\"\n";
+    std::ios_base::fmtflags ff, fn;
+	ff = ostrm.flags();
+	fn = ff;
+  	fn &= ~std::cout.basefield;   // unset basefield bits
+	fn |= std::ios::hex;
+	fn |= std::ios::showbase;
+	fn |= std::ios::uppercase;
+
+	for (std::vector<P1_StatsUnit>::iterator it = vecStats.begin(); it != vecStats.end(); it++) {
+		// a group of functions has no address
+		ostrm << "\"";
+		if (it->idFunc != P1_INVALID_ID) {
+			ostrm.flags(fn);
+			ostrm << it->dwAddr;
+			ostrm.flags(ff);
+		}
+
+		// inclusive time and memory are per outermost call
+		unsigned unOuterInvokeTimes = it->unInvokeTimes - it->unRecursiveInvokeTimes;
+		ostrm << "\",\"" << it->strName << "\",\"" 
+			<< it->unTotalSlefTime / it->unInvokeTimes << "\",\"" 
+			<< it->unTotalTime / unOuterInvokeTimes << "\",\"" 
+			<< (int)(it->nTotalMem / (int)unOuterInvokeTimes) << "\",\""
+			<< it->unTotalSlefTime << "\",\"" 
+			<< it->unTotalTime << "\",\""
+			<< it->nTotalMem << "\",\""
+			<< it->unInvokeTimes << "\",\""
+			<< it->unRecursiveInvokeTimes << "\",\""
+			<< it->unMaxRecursionDepth << "\",\"";
+		WriteHistogram(ostrm, it->arrSelfTimeHist);
+
+		// module, offset and the time stamp of the build identify the
+		// function in every process
+		DWORD64 dwOffset = 0;
+		P1_Module module;
+		unsigned idModule = m_registry.GetModule(it->idFunc, dwOffset);
+		std::string strModule = GetModuleTitle(idModule);
+		ostrm << "\",\"" << strModule << "\",\"";
+		if (!strModule.empty() && m_modules.GetModule(idModule, module)) {
+			ostrm.flags(fn);
+			ostrm << dwOffset << "\",\"" << module.dwTimeStamp;
+			ostrm.flags(ff);
+		} else {
+			ostrm << "\",\"";
+		}
+		ostrm << "\"\n";
+	}
+	ostrm.close();
+	return true;
+}
+
+unsigned Profiler1::InternPath(unsigned idParent, unsigned idFunc)
+{
+	DWORD64 dwKey = ((DWORD64)idParent << 32) | idFunc;
+	std::unordered_map<DWORD64, unsigned>::iterator it = m_mapPathIds.find(dwKey);
+	if (it != m_mapPathIds.end()) {
+		return it->second;
+	}
+	unsigned idPath = m_vecPaths.size();
+	P1_CallPath path;
+	path.idParent = idParent;
+	path.idFunc = idFunc;
+	m_vecPaths.push_back(path);
+	m_mapPathIds[dwKey] = idPath;
+	return idPath;
+}
+
+std::string Profiler1::GetCallPathName(unsigned idPath, P1_RollupKind kind)
+{
+	std::vector<unsigned> vecFuncs;
+	for (; idPath < m_vecPaths.size(); idPath = m_vecPaths[idPath].idParent) {
+		vecFuncs.push_back(m_vecPaths[idPath].idFunc);
+	}
+	std::string strPath;
+	for (size_t i = vecFuncs.size(); i > 0; i--) {
+		strPath += GetGroupName(vecFuncs[i - 1], kind);
+		if (i > 1) {
+			strPath += ";";
+		}
+	}
+	return strPath;
+}
+
+static bool CompareSelfTime(const P1_StatsAccum& sl, const P1_StatsAccum& sr) {
+	return sl.unTotalSelfTime > sr.unTotalSelfTime;
+}
+
+bool Profiler1::WriteCallPathStatistic(const char * filename, P1_RollupKind kind)
+{
+	// with a rollup the paths of the same groups are added up. They have the same
+	// depth, so none runs inside another and their total times add up too.
+	// idFunc is the row in vecNames
+	std::vector<P1_StatsAccum> vecPaths;
+	std::vector<std::string> vecNames;
+	std::vector<unsigned> vecHist;	// P1_HIST_BUCKETS per row of vecNames
+	std::unordered_map<std::string, unsigned> mapNames;
+	for (size_t p = 0; p < m_vecPathStats.size(); p++) {
+		if (!m_vecPathStats[p].unInvokeTimes) {
+			continue;
+		}
+		const unsigned * pHist = &m_vecPathSelfTimeHist[p * P1_HIST_BUCKETS];
+		std::string strPath = GetCallPathName((unsigned)p, kind);
+		if (kind != P1_ROLLUP_FUNCTION) {
+			std::unordered_map<std::string, unsigned>::iterator it = mapNames.find(strPath);
+			if (it != mapNames.end()) {
+				vecPaths[it->second].Merge(m_vecPathStats[p]);
+				for (int b = 0; b < P1_HIST_BUCKETS; b++) {
+					vecHist[(size_t)it->second * P1_HIST_BUCKETS + b] += pHist[b];
+				}
+				continue;
+			}
+			mapNames[strPath] = (unsigned)vecPaths.size();
+		}
+		vecPaths.push_back(m_vecPathStats[p]);
+		vecPaths.back().idFunc = (unsigned)vecNames.size();
+		vecNames.push_back(strPath);
+		vecHist.insert(vecHist.end(), pHist, pHist + P1_HIST_BUCKETS);
+	}
+	std::sort(vecPaths.begin(), vecPaths.end(), CompareSelfTime);
+
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	ostrm << "\"Path\",\"AvgSelfTime(us)\",\"AvgTime(us)\",\"TotalSelfTime(us)\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\",\"SelfTimeHistogram\"\n";
+	for (std::vector<P1_StatsAccum>::iterator it = vecPaths.begin(); it != vecPaths.end(); it++) {
+		ostrm << "\"" << vecNames[it->idFunc] << "\",\""
+			<< it->unTotalSelfTime / it->unInvokeTimes << "\",\""
+			<< it->unTotalTime / it->unInvokeTimes << "\",\""
+			<< it->unTotalSelfTime << "\",\""
+			<< it->unTotalTime << "\",\""
+			<< it->nTotalMem << "\",\""
+			<< it->unInvokeTimes << "\",\"";
+		WriteHistogram(ostrm, &vecHist[(size_t)it->idFunc * P1_HIST_BUCKETS]);
+		ostrm << "\"\n";
+	}
+	ostrm.close();
+	return true;
+}
+
+std::vector<unsigned> Profiler1::GetOutlierFrames()
+{
+	return m_vecOutlierFrames;
+}
+
+static bool CompareExcessTime(const P1_OutlierPath& pl, const P1_OutlierPath& pr) {
+	return pl.nExcessTime > pr.nExcessTime;
+}
+
+static bool CompareFunctionExcessTime(const P1_OutlierFunction& fl, const P1_OutlierFunction& fr) {
+	return fl.nExcessTime > fr.nExcessTime;
+}
+
+P1_Outlier Profiler1::GetOutlier(unsigned unFrame)
+{
+	std::vector<unsigned> vecNoGroups;
+	return RankOutlier(unFrame, vecNoGroups, vecNoGroups, m_vecFunctionBaseline, m_vecPathBaseline);
+}
+
+P1_Outlier Profiler1::RankOutlier(unsigned unFrame, const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+	const std::vector<unsigned>& vecFuncBaseline, const std::vector<unsigned>& vecPathBaseline)
+{
+	P1_Outlier outlier;
+	if (unFrame >= m_vecFrameStats.size()) {
+		return outlier;
+	}
+	outlier.idFrame = unFrame;
+	outlier.unTotalTime = GetFrameTime(m_vecFrames[unFrame]);
+	outlier.unBaselineTime = m_unBaselineFrameTime;
+
+	std::vector<P1_OutlierFunction> vecFunctions;
+	std::vector<P1_OutlierPath> vecPaths;
+	GetFrameGroups(unFrame, vecFuncGroups, vecPathGroups, vecFunctions, vecPaths);
+	for (size_t i = 0; i < vecFunctions.size(); i++) {
+		P1_OutlierFunction& function = vecFunctions[i];
+		function.unBaselineTime = function.idFunc < vecFuncBaseline.size() ? vecFuncBaseline[function.idFunc] : 0;
+		function.nExcessTime = (int)function.unSelfTime - (int)function.unBaselineTime;
+		if (function.nExcessTime > 0) {
+			outlier.vecFunctions.push_back(function);
+		}
+	}
+	std::sort(outlier.vecFunctions.begin(), outlier.vecFunctions.end(), CompareFunctionExcessTime);
+	for (size_t i = 0; i < vecPaths.size(); i++) {
+		P1_OutlierPath& path = vecPaths[i];
+		path.unBaselineTime = path.idPath < vecPathBaseline.size() ? vecPathBaseline[path.idPath] : 0;
+		path.nExcessTime = (int)path.unSelfTime - (int)path.unBaselineTime;
+		if (path.nExcessTime > 0) {
+			outlier.vecPaths.push_back(path);
+		}
+	}
+	std::sort(outlier.vecPaths.begin(), outlier.vecPaths.end(), CompareExcessTime);
+	return outlier;
+}
+
+bool Profiler1::WriteOutlierReport(const char * filename, unsigned unTop, P1_RollupKind kind)
+{
+	// with a rollup the functions and paths of a group are added up, in the frame and in
+	// the sampled frames of the baseline. Ids in the outliers are then groups
+	std::vector<unsigned> vecFuncGroups;
+	std::vector<unsigned> vecPathGroups;
+	std::vector<std::string> vecPathNames;	// indexed by path group
+	std::vector<unsigned> vecFuncBaseline = m_vecFunctionBaseline;
+	std::vector<unsigned> vecPathBaseline = m_vecPathBaseline;
+	if (kind != P1_ROLLUP_FUNCTION && kind < P1_ROLLUP_KINDS) {
+		RollupIndex& index = GetRollupIndex(kind);
+		vecFuncGroups = index.vecGroups;
+		std::unordered_map<std::string, unsigned> mapPaths;
+		vecPathGroups.resize(m_vecPaths.size());
+		for (size_t p = 0; p < m_vecPaths.size(); p++) {
+			std::string strPath = GetCallPathName((unsigned)p, kind);
+			std::unordered_map<std::string, unsigned>::iterator it = mapPaths.find(strPath);
+			if (it == mapPaths.end()) {
+				it = mapPaths.insert(std::make_pair(strPath, (unsigned)vecPathNames.size())).first;
+				vecPathNames.push_back(strPath);
+			}
+			vecPathGroups[p] = it->second;
+		}
+		vecFuncBaseline.assign(index.vecNames.size(), 0);
+		vecPathBaseline.assign(vecPathNames.size(), 0);
+		GetBaselines(vecFuncGroups, vecPathGroups, vecFuncBaseline, vecPathBaseline);
+	}
+
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	ostrm << "\"Frame\",\"TotalTime(us)\",\"BaselineTime(us)\",\"ExcessTime(us)\",\"Kind\",\"Rank\",\"Name\",\"SelfTime(us)\",\"BaselineSelfTime(us)\",\"ExcessSelfTime(us)\",\"InvokeTimes\"\n";
+	for (size_t k = 0; k < m_vecOutlierFrames.size(); k++) {
+		P1_Outlier outlier = RankOutlier(m_vecOutlierFrames[k], vecFuncGroups, vecPathGroups, vecFuncBaseline, vecPathBaseline);
+		for (size_t i = 0; i < outlier.vecFunctions.size() && i < unTop; i++) {
+			P1_OutlierFunction& function = outlier.vecFunctions[i];
+			ostrm << "\"" << outlier.idFrame << "\",\""
+				<< outlier.unTotalTime << "\",\""
+				<< outlier.unBaselineTime << "\",\""
+				<< (int)outlier.unTotalTime - (int)outlier.unBaselineTime << "\",\"Function\",\""
+				<< i + 1 << "\",\""
+				<< (vecFuncGroups.empty() ? GetFunctionName(m_registry.GetAddress(function.idFunc))
+					: GetRollupIndex(kind).vecNames[function.idFunc]) << "\",\""
+				<< function.unSelfTime << "\",\""
+				<< function.unBaselineTime << "\",\""
+				<< function.nExcessTime << "\",\""
+				<< function.unInvokeTimes << "\"\n";
+		}
+		for (size_t i = 0; i < outlier.vecPaths.size() && i < unTop; i++) {
+			P1_OutlierPath& path = outlier.vecPaths[i];
+			ostrm << "\"" << outlier.idFrame << "\",\""
+				<< outlier.unTotalTime << "\",\""
+				<< outlier.unBaselineTime << "\",\""
+				<< (int)outlier.unTotalTime - (int)outlier.unBaselineTime << "\",\"Path\",\""
+				<< i + 1 << "\",\""
+				<< (vecPathGroups.empty() ? GetCallPathName(path.idPath) : vecPathNames[path.idPath]) << "\",\""
+				<< path.unSelfTime << "\",\""
+				<< path.unBaselineTime << "\",\""
+				<< path.nExcessTime << "\",\""
+				<< path.unInvokeTimes << "\"\n";
+		}
+	}
+	ostrm.close();
+	return true;
+}
+
+std::vector<P1_Flow> Profiler1::GetFlows()
+{
+	return m_vecFlows;
+}
+
+std::vector<P1_FlowStats> Profiler1::GetFlowStatistic()
+{
+	return m_vecFlowStats;
+}
+
+bool Profiler1::WriteFlowStatistic(const char * filename, P1_RollupKind kind)
+{
+	// with a rollup the submitting paths of the same groups are added up,
+	// idPath is the row in vecNames
+	std::vector<P1_FlowStats> vecFlowStats;
+	std::vector<std::string> vecNames;
+	std::unordered_map<std::string, unsigned> mapNames;
+	for (size_t i = 0; i < m_vecFlowStats.size(); i++) {
+		const P1_FlowStats& stats = m_vecFlowStats[i];
+		std::string strPath = GetCallPathName(stats.idPath, kind);
+		if (kind != P1_ROLLUP_FUNCTION) {
+			std::unordered_map<std::string, unsigned>::iterator it = mapNames.find(strPath);
+			if (it != mapNames.end()) {
+				P1_FlowStats& row = vecFlowStats[it->second];
+				row.unTasks += stats.unTasks;
+				row.i64TotalQueueTime += stats.i64TotalQueueTime;
+				row.i64TotalRunTime += stats.i64TotalRunTime;
+				row.unMaxQueueTime = (std::max)(row.unMaxQueueTime, stats.unMaxQueueTime);
+				continue;
+			}
+			mapNames[strPath] = (unsigned)vecFlowStats.size();
+		}
+		vecFlowStats.push_back(stats);
+		vecFlowStats.back().idPath = (unsigned)vecNames.size();
+		vecNames.push_back(strPath);
+	}
+	std::sort(vecFlowStats.begin(), vecFlowStats.end(), CompareRunTime);
+
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	ostrm << "\"Path\",\"Tasks\",\"AvgQueueTime(us)\",\"MaxQueueTime(us)\",\"TotalQueueTime(us)\",\"AvgRunTime(us)\",\"TotalRunTime(us)\"\n";
+	for (size_t i = 0; i < vecFlowStats.size(); i++) {
+		P1_FlowStats& stats = vecFlowStats[i];
+		ostrm << "\"" << vecNames[stats.idPath] << "\",\""
+			<< stats.unTasks << "\",\""
+			<< stats.i64TotalQueueTime / stats.unTasks << "\",\""
+			<< stats.unMaxQueueTime << "\",\""
+			<< stats.i64TotalQueueTime << "\",\""
+			<< stats.i64TotalRunTime / stats.unTasks << "\",\""
+			<< stats.i64TotalRunTime << "\"\n";
+	}
+	ostrm.close();
+	return true;
+}
+
+unsigned Profiler1::AddBudget(const P1_Budget& budget)
+{
+	m_vecBudgets.push_back(budget);
+	return (unsigned)m_vecBudgets.size() - 1;
+}
+
+unsigned Profiler1::AddSelfTimeBudget(const char * szFunction, double dPercentile, double dLimit)
+{
+	P1_Budget budget;
+	budget.kind = P1_BUDGET_SELF_TIME;
+	budget.strName = szFunction;
+	budget.dPercentile = dPercentile;
+	budget.dLimit = dLimit;
+	return AddBudget(budget);
+}
+
+unsigned Profiler1::AddFrameTimeBudget(double dLimit, unsigned unFrame)
+{
+	P1_Budget budget;
+	budget.kind = P1_BUDGET_FRAME_TIME;
+	budget.unFrame = unFrame;
+	budget.dLimit = dLimit;
+	return AddBudget(budget);
+}
+
+unsigned Profiler1::AddFrameMemoryBudget(double dLimit, unsigned unFrame)
+{
+	P1_Budget budget;
+	budget.kind = P1_BUDGET_FRAME_MEMORY;
+	budget.unFrame = unFrame;
+	budget.dLimit = dLimit;
+	return AddBudget(budget);
+}
+
+void Profiler1::ClearBudgets()
+{
+	m_vecBudgets.clear();
+}
+
+void Profiler1::CheckFrameBudget(const P1_Budget& budget, unsigned unFrame, P1_BudgetResult& result)
+{
+	P1_FrameData& frame = m_vecFrames[unFrame];
+	if (!frame.i64EndTime) {
+		return;
+	}
+	double dValue = budget.kind == P1_BUDGET_FRAME_TIME
+		? (double)GetFrameTime(frame) : (double)(int)(frame.unEndMem - frame.unStartMem);
+	if (result.unSamples == 0 || dValue > result.dValue) {
+		result.dValue = dValue;
+		result.unFrame = unFrame;
+	}
+	if (result.unSamples == 0) {
+		result.bPass = true;
+	}
+	result.unSamples++;
+	if (dValue > budget.dLimit) {
+		result.unViolations++;
+		result.bPass = false;
+	}
+}
+
+std::vector<P1_BudgetResult> Profiler1::CheckBudgets()
+{
+	std::vector<P1_BudgetResult> vecResults(m_vecBudgets.size());
+	std::unordered_map<std::string, unsigned> mapNames;	// function names of the self time budgets
+	std::vector<unsigned> vecBudgetNames(m_vecBudgets.size(), P1_INVALID_ID);
+	for (size_t b = 0; b < m_vecBudgets.size(); b++) {
+		P1_Budget& budget = m_vecBudgets[b];
+		vecResults[b].idBudget = (unsigned)b;
+		if (budget.kind == P1_BUDGET_SELF_TIME) {
+			std::unordered_map<std::string, unsigned>::iterator it = mapNames.find(budget.strName);
+			if (it == mapNames.end()) {
+				it = mapNames.insert(std::make_pair(budget.strName, (unsigned)mapNames.size())).first;
+			}
+			vecBudgetNames[b] = it->second;
+		} else if (budget.unFrame != P1_INVALID_ID) {
+			if (budget.unFrame < m_vecFrames.size()) {
+				CheckFrameBudget(budget, budget.unFrame, vecResults[b]);
+			}
+		} else {
+			for (unsigned k = 0; k < m_vecFrames.size(); k++) {
+				CheckFrameBudget(budget, k, vecResults[b]);
+			}
+		}
+	}
+	if (mapNames.empty()) {
+		return vecResults;
+	}
+
+	// self time of every call of the named functions, in one pass over the frames.
+	// all addresses of a name are gathered together
+	unsigned unFunctions = (unsigned)m_vecStats.size();
+	std::vector<unsigned> vecFuncNames(unFunctions, P1_INVALID_ID);
+	for (unsigned id = 0; id < unFunctions; id++) {
+		std::unordered_map<std::string, unsigned>::iterator it = mapNames.find(GetFunctionName(m_registry.GetAddress(id)));
+		if (it != mapNames.end()) {
+			vecFuncNames[id] = it->second;
+		}
+	}
+	std::vector<std::vector<unsigned>> vecSamples(mapNames.size());
+	for (size_t k = 0; k < m_vecFrames.size(); k++) {
+		P1_StackFrameArrays& stackFrames = m_vecFrames[k].stackFrames;
+		for (size_t i = 0; i < stackFrames.vecSelfTime.size(); i++) {
+			unsigned idFunc = stackFrames.vecFuncIds[i];
+			if (idFunc < unFunctions && vecFuncNames[idFunc] != P1_INVALID_ID) {
+				vecSamples[vecFuncNames[idFunc]].push_back(stackFrames.vecSelfTime[i]);
+			}
+		}
+	}
+
+	for (size_t b = 0; b < m_vecBudgets.size(); b++) {
+		if (vecBudgetNames[b] == P1_INVALID_ID) {
+			continue;
+		}
+		P1_Budget& budget = m_vecBudgets[b];
+		P1_BudgetResult& result = vecResults[b];
+		std::vector<unsigned>& vecCalls = vecSamples[vecBudgetNames[b]];
+		result.unSamples = (unsigned)vecCalls.size();
+		if (vecCalls.empty()) {
+			continue;
+		}
+		size_t szRank = PercentileRank(budget.dPercentile, vecCalls.size());
+		std::nth_element(vecCalls.begin(), vecCalls.begin() + szRank - 1, vecCalls.end());
+		result.dValue = vecCalls[szRank - 1];
+		result.bPass = result.dValue <= budget.dLimit;
+		for (size_t i = 0; i < vecCalls.size(); i++) {
+			if (vecCalls[i] > budget.dLimit) {
+				result.unViolations++;
+			}
+		}
+	}
+	return vecResults;
+}
+
+std::vector<P1_BudgetResult> Profiler1::CheckFrameBudgets(unsigned unFrame)
+{
+	std::vector<P1_BudgetResult> vecResults;
+	if (unFrame >= m_vecFrames.size()) {
+		return vecResults;
+	}
+	for (size_t b = 0; b < m_vecBudgets.size(); b++) {
+		P1_Budget& budget = m_vecBudgets[b];
+		if (budget.kind == P1_BUDGET_SELF_TIME
+			|| (budget.unFrame != P1_INVALID_ID && budget.unFrame != unFrame)) {
+			continue;
+		}
+		P1_BudgetResult result;
+		result.idBudget = (unsigned)b;
+		CheckFrameBudget(budget, unFrame, result);
+		vecResults.push_back(result);
+	}
+	return vecResults;
+}
+
+bool Profiler1::WriteModuleMap(const char * filename)
+{
+	std::vector<P1_Module> vecModules = m_modules.GetModules();
+
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	ostrm << "\"Module\",\"Name\",\"Path\",\"Base\",\"Size\",\"TimeStamp\",\"Loaded\"\n";
+	for (size_t i = 0; i < vecModules.size(); i++) {
+		P1_Module& module = vecModules[i];
+		ostrm << "\"" << i << "\",\""
+			<< GetModuleTitle((unsigned)i) << "\",\""
+			<< module.strPath << "\",\""
+			<< "0X" << std::hex << std::uppercase << module.dwBase << "\",\""
+			<< "0X" << module.dwSize << "\",\""
+			<< "0X" << module.dwTimeStamp << std::dec << std::nouppercase << "\",\""
+			<< (module.bLoaded ? 1 : 0) << "\"\n";
+	}
+	ostrm.close();
+	return true;
+}
+
+bool Profiler1::WriteFrameStatistic(const char * filename)
+{
+	// every counter seen in the capture gets its own columns
+	std::vector<DWORD64> vecCounterIds;
+	std::vector<std::string> vecCounterNames;
+	for (size_t k = 0; k < m_vecCounterStats.size(); k++) {
+		std::map<DWORD64, P1_CounterStats>::iterator it = m_vecCounterStats[k].begin();
+		for (; it != m_vecCounterStats[k].end(); it++) {
+			if (std::find(vecCounterIds.begin(), vecCounterIds.end(), it->first) == vecCounterIds.end()) {
+				vecCounterIds.push_back(it->first);
+				vecCounterNames.push_back(it->second.strName);
+			}
+		}
+	}
+
+	std::ofstream ostrm(filename);
+	ostrm << "\"Frame\",\"StartTime\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\",\"Markers\",\"UnwoundFrames\",\"OrphanExits\"";
+	for (size_t c = 0; c < vecCounterNames.size(); c++) {
+		const std::string& strName = vecCounterNames[c];
+		ostrm << ",\"" << strName << ".Min\",\"" << strName << ".Max\",\""
+			<< strName << ".Avg\",\"" << strName << ".Last\"";
+	}
+	ostrm << "\n";
+
+	for (std::vector<P1_FrameData>::iterator it = m_vecFrames.begin(); it != m_vecFrames.end(); it++) {
+		__int64 i64LocalTimeCost = 0;
+		i64LocalTimeCost = it->i64EndTime - it->i64StartTime;
+		i64LocalTimeCost *= 1000000;
+		i64LocalTimeCost /= i64Frequency;
+
+		__int64 i64TimeStart = 0;
+		i64TimeStart = it->i64StartTime - i64StartTime;
+		i64TimeStart *= 1000000;
+		i64TimeStart /= i64Frequency;
+
+		unsigned unMarkers = 0;
+		for (size_t i = 0; i < it->vecEvents.size(); i++) {
+			if (it->vecEvents[i].bMarker) {
+				unMarkers++;
+			}
+		}
+
+		ostrm << "\"" << it->id << "\",\"" 
+			<< i64TimeStart << "\",\"" 
+			<< i64LocalTimeCost << "\",\""
+			<< it->unEndMem - it->unStartMem << "\",\""
+			<< it->stackFrames.size() << "\",\""
+			<< unMarkers << "\",\""
+			<< it->unUnwoundFrames << "\",\""
+			<< it->unOrphanExits << "\"";
+
+		for (size_t c = 0; c < vecCounterIds.size(); c++) {
+			std::map<DWORD64, P1_CounterStats>::iterator itCounter;
+			if (it->id < m_vecCounterStats.size()
+				&& (itCounter = m_vecCounterStats[it->id].find(vecCounterIds[c])) != m_vecCounterStats[it->id].end()) {
+				P1_CounterStats& stats = itCounter->second;
+				ostrm << ",\"" << stats.dMin << "\",\"" << stats.dMax << "\",\""
+					<< stats.dTotal / stats.unSamples << "\",\"" << stats.dLast << "\"";
+			} else {
+				ostrm << ",\"\",\"\",\"\",\"\"";
+			}
+		}
+		ostrm << "\n";
+	}
+	ostrm.close();
+	return true;
+}
+
+static void WriteJsonString(std::ostream& ostrm, const std::string& str)
+{
+	ostrm << "\"";
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str[i];
+		if (c == '"' || c == '\\') {
+			ostrm << '\\' << c;
+		} else if ((unsigned char)c < 0x20) {
+			ostrm << ' ';
+		} else {
+			ostrm << c;
+		}
+	}
+	ostrm << "\"";
+}
+
+bool Profiler1::WriteTimeline(const char * filename, P1_RollupKind kind)
+{
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	if (!ostrm) {
+		return false;
+	}
+	ostrm << std::fixed << std::setprecision(3);
+	ostrm << "{\"traceEvents\":[\n";
+
+	// timestamps are micro sec since Start()
+	double dTickToUs = 1000000.0 / i64Frequency;
+	bool bFirst = true;
+	for (std::vector<P1_FrameData>::iterator it = m_vecFrames.begin(); it != m_vecFrames.end(); it++) {
+		__int64 i64FrameEnd = it->i64EndTime ? it->i64EndTime : it->i64StartTime;
+
+		ostrm << (bFirst ? "" : ",\n") << "{\"name\":\"Frame " << it->id
+			<< "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":0,\"tid\":" << dwTargetThread
+			<< ",\"ts\":" << (it->i64StartTime - i64StartTime) * dTickToUs
+			<< ",\"dur\":" << (i64FrameEnd - it->i64StartTime) * dTickToUs << "}";
+		bFirst = false;
+
+		P1_StackFrameArrays& stackFrames = it->stackFrames;
+		for (size_t i = 0; i < stackFrames.size(); i++) {
+			__int64 i64Start = stackFrames.vecStartTime[i];
+			__int64 i64End = stackFrames.vecEndTime[i] ? stackFrames.vecEndTime[i] : i64FrameEnd;
+			ostrm << ",\n{\"name\":";
+			WriteJsonString(ostrm, GetGroupName(stackFrames.vecFuncIds[i], kind));
+			ostrm << ",\"cat\":\"call\",\"ph\":\"X\",\"pid\":0,\"tid\":" << dwTargetThread
+				<< ",\"ts\":" << (i64Start - i64StartTime) * dTickToUs
+				<< ",\"dur\":" << (i64End - i64Start) * dTickToUs << "}";
+		}
+
+		for (size_t i = 0; i < it->vecEvents.size(); i++) {
+			P1_Event& event = it->vecEvents[i];
+			std::string strName = GetFunctionName(event.dwId);
+			ostrm << ",\n{\"name\":";
+			WriteJsonString(ostrm, strName);
+			if (event.bMarker) {
+				ostrm << ",\"cat\":\"marker\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << dwTargetThread
+					<< ",\"ts\":" << (event.i64Time - i64StartTime) * dTickToUs << "}";
+			} else {
+				ostrm << ",\"cat\":\"counter\",\"ph\":\"C\",\"pid\":0"
+					<< ",\"ts\":" << (event.i64Time - i64StartTime) * dTickToUs << ",\"args\":{";
+				WriteJsonString(ostrm, strName);
+				ostrm << ":" << event.dValue << "}}";
+			}
+		}
+	}
+
+	// tasks on their worker threads, with an arrow from the submit to the begin
+	for (size_t f = 0; f < m_vecFlows.size(); f++) {
+		P1_Flow& flow = m_vecFlows[f];
+		if (!flow.i64BeginTime) {
+			continue;
+		}
+		std::string strName = flow.dwId ? GetFunctionName(flow.dwId) : "task";
+		__int64 i64End = flow.i64EndTime ? flow.i64EndTime : flow.i64BeginTime;
+		ostrm << (bFirst ? "" : ",\n") << "{\"name\":";
+		WriteJsonString(ostrm, strName);
+		ostrm << ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << flow.dwWorkerThread
+			<< ",\"ts\":" << (flow.i64BeginTime - i64StartTime) * dTickToUs
+			<< ",\"dur\":" << (i64End - flow.i64BeginTime) * dTickToUs
+			<< ",\"args\":{\"queue(us)\":" << flow.unQueueTime << "}}";
+		bFirst = false;
+		if (!flow.i64SubmitTime) {
+			continue;
+		}
+		ostrm << ",\n{\"name\":";
+		WriteJsonString(ostrm, strName);
+		ostrm << ",\"cat\":\"flow\",\"ph\":\"s\",\"id\":" << f << ",\"pid\":0,\"tid\":" << flow.dwSubmitThread
+			<< ",\"ts\":" << (flow.i64SubmitTime - i64StartTime) * dTickToUs << "}";
+		ostrm << ",\n{\"name\":";
+		WriteJsonString(ostrm, strName);
+		ostrm << ",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" << f << ",\"pid\":0,\"tid\":" << flow.dwWorkerThread
+			<< ",\"ts\":" << (flow.i64BeginTime - i64StartTime) * dTickToUs << "}";
+	}
+	ostrm << "\n]}\n";
+	ostrm.close();
+	return true;
+}
+
+bool Profiler1::WriteBudgetReport(const char * filename)
+{
+	std::vector<P1_BudgetResult> vecResults = CheckBudgets();
+	bool bPass = true;
+	for (size_t b = 0; b < vecResults.size(); b++) {
+		bPass = bPass && vecResults[b].bPass;
+	}
+
+	std::ofstream ostrm(filename, std::ofstream::trunc);
+	if (!ostrm) {
+		return false;
+	}
+	static const char * s_arrKinds[] = { "SelfTime", "FrameTime", "FrameMemory" };
+	ostrm << "{\"pass\":" << (bPass ? "true" : "false") << ",\"budgets\":[";
+	for (size_t b = 0; b < vecResults.size(); b++) {
+		P1_Budget& budget = m_vecBudgets[b];
+		P1_BudgetResult& result = vecResults[b];
+		ostrm << (b ? ",\n" : "\n") << "{\"id\":" << b << ",\"kind\":\"" << s_arrKinds[budget.kind] << "\"";
+		if (budget.kind == P1_BUDGET_SELF_TIME) {
+			ostrm << ",\"name\":";
+			WriteJsonString(ostrm, budget.strName);
+			ostrm << ",\"percentile\":" << budget.dPercentile;
+		} else if (budget.unFrame != P1_INVALID_ID) {
+			ostrm << ",\"frame\":" << budget.unFrame;
+		}
+		ostrm << ",\"limit\":" << budget.dLimit
+			<< ",\"value\":" << result.dValue;
+		if (result.unFrame != P1_INVALID_ID) {
+			ostrm << ",\"worstFrame\":" << result.unFrame;
+		}
+		ostrm << ",\"measured\":" << (result.unSamples ? "true" : "false")
+			<< ",\"samples\":" << result.unSamples
+			<< ",\"violations\":" << result.unViolations
+			<< ",\"pass\":" << (result.bPass ? "true" : "false") << "}";
+	}
+	ostrm << "\n]}\n";
+	ostrm.close();
+	return true;
+}
+
+std::vector<P1_Frame> Profiler1::GetFrames()
+{
+	std::vector<P1_Frame> vecFrames(m_vecFrames.size());
+	for (size_t k = 0; k < m_vecFrames.size(); k++) {
+		P1_FrameView view(m_vecFrames[k], m_registry);
+		P1_Frame& frame = vecFrames[k];
+		(P1_FrameInfo&)frame = view.info();
+		frame.vecStackFrames.reserve(view.size());
+		for (size_t i = 0; i < view.size(); i++) {
+			frame.vecStackFrames.push_back(view[i]);
+		}
+	}
+	return vecFrames;
+}
+
+P1_FrameView Profiler1::GetFrameView(unsigned unFrame)
+{
+	return P1_FrameView(m_vecFrames[unFrame], m_registry);
+}
+
+P1_FrameView::P1_FrameView(const P1_FrameData& frame, const P1_FunctionRegistry& registry)
+	: m_frame(frame), m_registry(registry)
+{
+}
+
+size_t P1_FrameView::size() const
+{
+	return m_frame.stackFrames.size();
+}
+
+const P1_FrameInfo& P1_FrameView::info() const
+{
+	return m_frame;
+}
+
+P1_StackFrame P1_FrameView::operator[](size_t i) const
+{
+	const P1_StackFrameArrays& stackFrames = m_frame.stackFrames;
+	P1_StackFrame frame;
+	frame.id = (unsigned)i;
+	frame.idFunc = stackFrames.vecFuncIds[i];
+	frame.dwAddr = m_registry.GetAddress(frame.idFunc);
+	frame.i64StartTime = stackFrames.vecStartTime[i];
+	frame.i64EndTime = stackFrames.vecEndTime[i];
+	frame.unStartMem = stackFrames.vecStartMem[i];
+	frame.unEndMem = stackFrames.vecEndMem[i];
+	frame.idCaller = stackFrames.vecCallerIds[i];
+	frame.bUnwound = stackFrames.vecUnwound[i] != 0;
+
+	// analyzed
+	if (i < stackFrames.vecTotalTime.size()) {
+		frame.unTotalTime = stackFrames.vecTotalTime[i];
+		frame.unSubTime = stackFrames.vecSubTime[i];
+		frame.unSelfTime = stackFrames.vecSelfTime[i];
+		frame.unRecursionDepth = stackFrames.vecRecursionDepth[i];
+		frame.idPath = stackFrames.vecPathIds[i];
+	}
+	return frame;
+}
+
+bool Profiler1::OpenLiveView()
+{
+	if (m_pLiveView) {
+		return true;
+	}
+	std::stringstream ssName;
+	ssName << "Local\\Profiler1_" << GetCurrentProcessId();
+	m_hLiveMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		0, sizeof(P1_LiveView), ssName.str().c_str());
+	if (m_hLiveMapping) {
+		m_pLiveView = (P1_LiveView *)MapViewOfFile(m_hLiveMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(P1_LiveView));
+	}
+	if (!m_pLiveView) {
+		std::stringstream ss;
+		ss << "#error:Profiler1::OpenLiveView: " << ssName.str()
+		<< " returned error: " << GetLastError() << std::endl;
+		m_vecMsgs.push_back(ss.str());
+		CloseLiveView();
+		return false;
+	}
+	memset(m_pLiveView, 0, sizeof(P1_LiveView));
+	m_pLiveView->dwProcessId = GetCurrentProcessId();
+	m_pLiveView->dwMagic = P1_LIVE_MAGIC;
+	m_vecLiveStats.clear();
+	m_vecLiveTop.clear();
+	m_vecLiveInTop.clear();
+	return true;
+}
+
+void Profiler1::CloseLiveView()
+{
+	if (m_pLiveView) {
+		UnmapViewOfFile(m_pLiveView);
+		m_pLiveView = NULL;
+	}
+	if (m_hLiveMapping) {
+		CloseHandle(m_hLiveMapping);
+		m_hLiveMapping = NULL;
+	}
+}
+
+static bool CompareLiveTop(const std::pair<unsigned, unsigned>& tl, const std::pair<unsigned, unsigned>& tr) {
+	return tl.first > tr.first;
+}
+
+void Profiler1::PublishLiveView(P1_FrameData& frame)
+{
+	// call paths are left to Analyze(), and names to the reader: nothing
+	// here hashes or looks up a symbol
+	m_vecLiveRow.clear();
+	AnalyzeFrame(frame, m_vecLiveRow, false);
+
+	if (m_vecLiveStats.size() < m_vecActiveCalls.size()) {
+		m_vecLiveStats.resize(m_vecActiveCalls.size());
+		m_vecLiveInTop.resize(m_vecActiveCalls.size(), false);
+	}
+	for (size_t i = 0; i < m_vecLiveRow.size(); i++) {
+		unsigned idFunc = m_vecLiveRow[i].idFunc;
+		m_vecLiveStats[idFunc].idFunc = idFunc;
+		m_vecLiveStats[idFunc].Merge(m_vecLiveRow[i]);
+		m_vecFrameRows[idFunc] = i;
+	}
+
+	// hottest functions since Start. Only the functions of this frame gained self
+	// time, so only they can enter the top, in place of its coolest
+	for (size_t i = 0; i < m_vecLiveTop.size(); i++) {
+		m_vecLiveTop[i].first = m_vecLiveStats[m_vecLiveTop[i].second].unTotalSelfTime;
+	}
+	std::make_heap(m_vecLiveTop.begin(), m_vecLiveTop.end(), CompareLiveTop);
+	for (size_t i = 0; i < m_vecLiveRow.size(); i++) {
+		unsigned idFunc = m_vecLiveRow[i].idFunc;
+		if (m_vecLiveInTop[idFunc]) {
+			continue;
+		}
+		unsigned unSelfTime = m_vecLiveStats[idFunc].unTotalSelfTime;
+		if (m_vecLiveTop.size() == P1_LIVE_TOP) {
+			if (unSelfTime <= m_vecLiveTop.front().first) {
+				continue;
+			}
+			std::pop_heap(m_vecLiveTop.begin(), m_vecLiveTop.end(), CompareLiveTop);
+			m_vecLiveInTop[m_vecLiveTop.back().second] = false;
+			m_vecLiveTop.pop_back();
+		}
+		m_vecLiveTop.push_back(std::make_pair(unSelfTime, idFunc));
+		std::push_heap(m_vecLiveTop.begin(), m_vecLiveTop.end(), CompareLiveTop);
+		m_vecLiveInTop[idFunc] = true;
+	}
+	std::pair<unsigned, unsigned> arrTop[P1_LIVE_TOP];
+	size_t szTop = m_vecLiveTop.size();
+	std::copy(m_vecLiveTop.begin(), m_vecLiveTop.end(), arrTop);
+	std::sort(arrTop, arrTop + szTop, CompareLiveTop);
+
+	unsigned unMarkers = 0;
+	for (size_t i = 0; i < frame.vecEvents.size(); i++) {
+		if (frame.vecEvents[i].bMarker) {
+			unMarkers++;
+		}
+	}
+
+	P1_LiveView * pView = m_pLiveView;
+	InterlockedIncrement(&pView->lSequence);
+
+	P1_LiveFrame& liveFrame = pView->arrFrames[frame.id % P1_LIVE_FRAMES];
+	liveFrame.id = frame.id;
+	liveFrame.unTotalTime = (unsigned)((frame.i64EndTime - frame.i64StartTime) * 1000000 / i64Frequency);
+	liveFrame.nTotalMem = (int)(frame.unEndMem - frame.unStartMem);
+	liveFrame.unStackFrames = frame.stackFrames.size();
+	liveFrame.unMarkers = unMarkers;
+	pView->unFrames = frame.id + 1;
+
+	for (size_t i = 0; i < szTop; i++) {
+		P1_LiveFunction& function = pView->arrFunctions[i];
+		unsigned idFunc = arrTop[i].second;
+		function.unTotalSelfTime = m_vecLiveStats[idFunc].unTotalSelfTime;
+		function.unInvokeTimes = m_vecLiveStats[idFunc].unInvokeTimes;
+		function.unFrameSelfTime = 0;
+		function.unFrameTotalTime = 0;
+		function.unFrameInvokeTimes = 0;
+		unsigned unRow = m_vecFrameRows[idFunc];
+		if (unRow != P1_INVALID_ID) {
+			function.unFrameSelfTime = m_vecLiveRow[unRow].unTotalSelfTime;
+			function.unFrameTotalTime = m_vecLiveRow[unRow].unTotalTime;
+			function.unFrameInvokeTimes = m_vecLiveRow[unRow].unInvokeTimes;
+		}
+		function.dwAddr = m_registry.GetAddress(idFunc);
+		function.szName[0] = 0;
+		if (function.dwAddr & P1_ZONE_FLAG) {
+			// zones are in the name table since their first entry
+			std::unordered_map<DWORD64, std::string>::iterator it = m_nametable.find(function.dwAddr);
+			if (it != m_nametable.end()) {
+				strncpy_s(function.szName, P1_LIVE_NAME, it->second.c_str(), _TRUNCATE);
+			}
+		}
+	}
+	pView->unFunctions = szTop;
+
+	InterlockedIncrement(&pView->lSequence);
+
+	for (size_t i = 0; i < m_vecLiveRow.size(); i++) {
+		m_vecFrameRows[m_vecLiveRow[i].idFunc] = P1_INVALID_ID;
+	}
+}
+
+void Profiler1::SetTargetThread(DWORD dwThreadId)
+{
+	dwTargetThread = dwThreadId;
+}
+
+P1_FunctionRegistry::P1_FunctionRegistry()
+{
+	for (unsigned i = 0; i < SLOTS; i++) {
+		m_arrKeys[i].store(0, std::memory_order_relaxed);
+		m_arrIds[i].store(P1_INVALID_ID, std::memory_order_relaxed);
+	}
+	memset(m_arrOffsets, 0, sizeof(m_arrOffsets));
+	for (unsigned i = 0; i < P1_MAX_FUNCTIONS; i++) {
+		m_arrAddrs[i].store(0, std::memory_order_relaxed);
+		m_arrModules[i] = P1_INVALID_ID;
+		m_arrNotified[i] = P1_INVALID_ID;
+		m_arrRetired[i].store(false, std::memory_order_relaxed);
+	}
+	m_unUnloads = 0;
+	m_unResolved = 0;
+	m_unSize.store(0, std::memory_order_release);
+}
+
+unsigned P1_FunctionRegistry::GetId(DWORD64 dwAddr, const P1_ModuleMap * pModules)
+{
+	unsigned unSlot = (unsigned)((dwAddr * 0x9E3779B97F4A7C15ULL) >> 32) & (SLOTS - 1);
+	for (;;) {
+		DWORD64 dwKey = m_arrKeys[unSlot].load(std::memory_order_acquire);
+		if (dwKey == dwAddr) {
+			unsigned id;
+			// the thread which claimed the slot is about to publish the id
+			while ((id = m_arrIds[unSlot].load(std::memory_order_acquire)) == P1_INVALID_ID) {
+			}
+			if (!m_arrRetired[id].load(std::memory_order_relaxed)) {
+				return id;
+			}
+			// its module was unloaded, the address belongs to the one loaded there now.
+			// the slot is claimed before the new id is taken, readers wait for it as
+			// for a new slot
+			if (!m_arrIds[unSlot].compare_exchange_strong(id, P1_INVALID_ID, std::memory_order_acq_rel)) {
+				// replaced by another thread, check it again
+				continue;
+			}
+			unsigned idNew = NewId(dwAddr, pModules);
+			m_arrIds[unSlot].store(idNew, std::memory_order_release);
+			return idNew;
+		}
+		if (dwKey == 0) {
+			if (m_unSize.load(std::memory_order_relaxed) >= P1_MAX_FUNCTIONS - 1) {
+				// full, share the last id
+				return P1_MAX_FUNCTIONS - 1;
+			}
+			if (!m_arrKeys[unSlot].compare_exchange_strong(dwKey, dwAddr, std::memory_order_acq_rel)) {
+				// claimed by another thread, check it again
+				continue;
+			}
+			unsigned id = NewId(dwAddr, pModules);
+			m_arrIds[unSlot].store(id, std::memory_order_release);
+			return id;
+		}
+		unSlot = (unSlot + 1) & (SLOTS - 1);
+	}
+}
+
+unsigned P1_FunctionRegistry::NewId(DWORD64 dwAddr, const P1_ModuleMap * pModules)
+{
+	unsigned id = m_unSize.fetch_add(1, std::memory_order_relaxed);
+	if (id >= P1_MAX_FUNCTIONS - 1) {
+		return P1_MAX_FUNCTIONS - 1;
+	}
+	m_arrNotified[id] = pModules ? pModules->GetNotified() : P1_INVALID_ID;
+	m_arrAddrs[id].store(dwAddr, std::memory_order_release);
+	return id;
+}
+
+void P1_FunctionRegistry::Sync(P1_ModuleMap& modules)
+{
+	// the module of each new function, with the dll events queued before it was
+	// registered applied. An id is counted before its address is written, the
+	// rest waits for the next call
+	unsigned unSize = (std::min)(Size(), (unsigned)P1_MAX_FUNCTIONS - 1);
+	for (; m_unResolved < unSize; m_unResolved++) {
+		DWORD64 dwAddr = m_arrAddrs[m_unResolved].load(std::memory_order_acquire);
+		if (!dwAddr) {
+			break;
+		}
+		if (m_arrNotified[m_unResolved] == P1_INVALID_ID) {
+			continue;
+		}
+		modules.Update(m_arrNotified[m_unResolved]);
+		m_arrModules[m_unResolved] = modules.Find(dwAddr, m_arrOffsets[m_unResolved]);
+	}
+	modules.Update();
+
+	unsigned unUnloads = modules.GetUnloads();
+	if (unUnloads == m_unUnloads) {
+		return;
+	}
+	m_unUnloads = unUnloads;
+
+	std::vector<P1_Module> vecModules = modules.GetModules();
+	for (unsigned id = 0; id < m_unResolved; id++) {
+		unsigned idModule = m_arrModules[id];
+		if (idModule < vecModules.size() && !vecModules[idModule].bLoaded) {
+			m_arrRetired[id].store(true, std::memory_order_relaxed);
+		}
+	}
+}
+
+DWORD64 P1_FunctionRegistry::GetAddress(unsigned id) const
+{
+	return id < P1_MAX_FUNCTIONS ? m_arrAddrs[id].load(std::memory_order_relaxed) : 0;
+}
+
+unsigned P1_FunctionRegistry::GetModule(unsigned id, DWORD64& dwOffset) const
+{
+	if (id >= P1_MAX_FUNCTIONS) {
+		dwOffset = 0;
+		return P1_INVALID_ID;
+	}
+	dwOffset = m_arrOffsets[id];
+	return m_arrModules[id];
+}
+
+unsigned P1_FunctionRegistry::Size() const
+{
+	// once full, the shared last id is in use
+	unsigned unSize = m_unSize.load(std::memory_order_acquire);
+	return unSize >= P1_MAX_FUNCTIONS - 1 ? P1_MAX_FUNCTIONS : unSize;
+}
+
+P1_ModuleMap::P1_ModuleMap()
+{
+	InitializeCriticalSection(&m_cs);
+	m_pRanges.store(new std::vector<P1_ModuleRange>(), std::memory_order_release);
+	m_unNotified.store(0, std::memory_order_relaxed);
+	m_unApplied.store(0, std::memory_order_relaxed);
+	m_unUnloads.store(0, std::memory_order_relaxed);
+}
+
+P1_ModuleMap::~P1_ModuleMap()
+{
+	delete m_pRanges.load(std::memory_order_acquire);
+	for (size_t i = 0; i < m_vecRetiredRanges.size(); i++) {
+		delete m_vecRetiredRanges[i];
+	}
+	DeleteCriticalSection(&m_cs);
+}
+
+void P1_ModuleMap::Refresh()
+{
+	HANDLE hProcess = GetCurrentProcess();
+	std::vector<HMODULE> vecHandles(256);
+	DWORD dwNeeded = 0;
+	while (EnumProcessModules(hProcess, vecHandles.data(), (DWORD)(vecHandles.size() * sizeof(HMODULE)), &dwNeeded)
+		&& dwNeeded > vecHandles.size() * sizeof(HMODULE)) {
+		vecHandles.resize(dwNeeded / sizeof(HMODULE));
+	}
+	vecHandles.resize((std::min)(vecHandles.size(), (size_t)(dwNeeded / sizeof(HMODULE))));
+
+	EnterCriticalSection(&m_cs);
+	// modules unloaded since the last snapshot
+	for (size_t i = 0; i < m_vecModules.size(); i++) {
+		if (m_vecModules[i].bLoaded
+			&& std::find(vecHandles.begin(), vecHandles.end(), (HMODULE)(ULONG_PTR)m_vecModules[i].dwBase) == vecHandles.end()) {
+			m_vecModules[i].bLoaded = false;
+			m_unUnloads++;
+		}
+	}
+	LeaveCriticalSection(&m_cs);
+
+	for (size_t i = 0; i < vecHandles.size(); i++) {
+		MODULEINFO info;
+		char szPath[MAX_PATH] = { 0 };
+		if (!GetModuleInformation(hProcess, vecHandles[i], &info, sizeof(info))) {
+			continue;
+		}
+		GetModuleFileNameA(vecHandles[i], szPath, MAX_PATH);
+		AddModule(szPath, (DWORD64)(ULONG_PTR)info.lpBaseOfDll, info.SizeOfImage);
+	}
+}
+
+void P1_ModuleMap::AddModule(const std::string& strPath, DWORD64 dwBase, DWORD dwSize)
+{
+	EnterCriticalSection(&m_cs);
+	for (size_t i = 0; i < m_vecModules.size(); i++) {
+		P1_Module& module = m_vecModules[i];
+		if (module.bLoaded && module.dwBase == dwBase) {
+			if (module.strPath == strPath && module.dwSize == dwSize) {
+				LeaveCriticalSection(&m_cs);
+				return;
+			}
+			// missed the unload
+			module.bLoaded = false;
+			m_unUnloads++;
+		}
+	}
+
+	P1_Module module;
+	module.strPath = strPath;
+	module.dwBase = dwBase;
+	module.dwSize = dwSize;
+	module.bLoaded = true;
+	PIMAGE_NT_HEADERS pHeaders = ImageNtHeader((PVOID)(ULONG_PTR)dwBase);
+	if (pHeaders) {
+		module.dwTimeStamp = pHeaders->FileHeader.TimeDateStamp;
+	}
+	m_vecModules.push_back(module);
+	Publish();
+	LeaveCriticalSection(&m_cs);
+}
+
+void P1_ModuleMap::RemoveModule(DWORD64 dwBase)
+{
+	EnterCriticalSection(&m_cs);
+	for (size_t i = 0; i < m_vecModules.size(); i++) {
+		if (m_vecModules[i].bLoaded && m_vecModules[i].dwBase == dwBase) {
+			m_vecModules[i].bLoaded = false;
+			m_unUnloads++;
+		}
+	}
+	Publish();
+	LeaveCriticalSection(&m_cs);
+}
+
+void P1_ModuleMap::Notify(bool bLoaded, DWORD64 dwBase, DWORD dwSize, const WCHAR * szPath, size_t szLen)
+{
+	// the loader calls one notification at a time
+	unsigned unIndex = m_unNotified.load(std::memory_order_relaxed);
+	P1_ModuleEvent& event = m_arrEvents[unIndex % P1_MODULE_EVENTS];
+	event.dwBase = dwBase;
+	event.dwSize = dwSize;
+	event.bLoaded = bLoaded;
+	int nLen = 0;
+	if (szPath) {
+		nLen = WideCharToMultiByte(CP_ACP, 0, szPath, (int)szLen, event.szPath, MAX_PATH - 1, NULL, NULL);
+	}
+	event.szPath[(std::max)(nLen, 0)] = 0;
+	m_unNotified.store(unIndex + 1, std::memory_order_release);
+}
+
+unsigned P1_ModuleMap::GetNotified() const
+{
+	return m_unNotified.load(std::memory_order_acquire);
+}
+
+void P1_ModuleMap::Update(unsigned unEvents)
+{
+	if (m_unNotified.load(std::memory_order_acquire) == m_unApplied.load(std::memory_order_acquire)) {
 		return;
-	} else {
-		size_t szFrame = s_pProfiler1->m_vecFrames.size();
-		if (szFrame <= 0) {
+	}
+	EnterCriticalSection(&m_cs);
+	unsigned unApplied = m_unApplied.load(std::memory_order_relaxed);
+	unsigned unNotified = m_unNotified.load(std::memory_order_acquire);
+	if (unEvents != P1_INVALID_ID) {
+		// counters wrap, compare their distances from the applied one
+		if ((int)(unEvents - unApplied) <= 0) {
+			LeaveCriticalSection(&m_cs);
 			return;
 		}
-		P1_Frame& frame = s_pProfiler1->m_vecFrames[szFrame - 1];
-		unsigned int idFrame = s_pProfiler1->m_stackFrames.top();
+		if ((int)(unNotified - unEvents) > 0) {
+			unNotified = unEvents;
+		}
+	}
+	std::vector<P1_ModuleEvent> vecEvents;
+	for (unsigned i = unApplied; i != unNotified && unNotified - unApplied < P1_MODULE_EVENTS; i++) {
+		vecEvents.push_back(m_arrEvents[i % P1_MODULE_EVENTS]);
+	}
+
+	// the loader may be writing the next event while the ring is copied, once it
+	// is P1_MODULE_EVENTS ahead that event lands on the first one copied
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (m_unNotified.load(std::memory_order_relaxed) - unApplied >= P1_MODULE_EVENTS) {
+		// the ring was overwritten before it was read, list the modules again
+		unNotified = m_unNotified.load(std::memory_order_acquire);
+		Refresh();
+	} else {
+		for (size_t i = 0; i < vecEvents.size(); i++) {
+			P1_ModuleEvent& event = vecEvents[i];
+			if (!event.bLoaded) {
+				RemoveModule(event.dwBase);
+				continue;
+			}
+			// pin the dll while its headers are read, it may be gone already
+			HMODULE hModule = NULL;
+			if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR)(ULONG_PTR)event.dwBase, &hModule)) {
+				if (hModule == (HMODULE)(ULONG_PTR)event.dwBase) {
+					AddModule(event.szPath, event.dwBase, event.dwSize);
+				}
+				FreeLibrary(hModule);
+			}
+		}
+	}
+	m_unApplied.store(unNotified, std::memory_order_release);
+	LeaveCriticalSection(&m_cs);
+}
+
+unsigned P1_ModuleMap::GetUnloads() const
+{
+	return m_unUnloads.load(std::memory_order_acquire);
+}
+
+static bool CompareRangeBase(const P1_ModuleRange& rl, const P1_ModuleRange& rr) {
+	return rl.dwBase < rr.dwBase;
+}
+
+static bool CompareAddrRange(DWORD64 dwAddr, const P1_ModuleRange& range) {
+	return dwAddr < range.dwBase;
+}
+
+void P1_ModuleMap::Publish()
+{
+	std::vector<P1_ModuleRange> * pRanges = new std::vector<P1_ModuleRange>();
+	for (size_t i = 0; i < m_vecModules.size(); i++) {
+		if (m_vecModules[i].bLoaded) {
+			P1_ModuleRange range;
+			range.dwBase = m_vecModules[i].dwBase;
+			range.dwEnd = m_vecModules[i].dwBase + m_vecModules[i].dwSize;
+			range.idModule = (unsigned)i;
+			pRanges->push_back(range);
+		}
+	}
+	std::sort(pRanges->begin(), pRanges->end(), CompareRangeBase);
+
+	// a hook may still be reading the old table, it is freed with the map
+	m_vecRetiredRanges.push_back(m_pRanges.exchange(pRanges, std::memory_order_acq_rel));
+}
+
+unsigned P1_ModuleMap::Find(DWORD64 dwAddr, DWORD64& dwOffset) const
+{
+	dwOffset = 0;
+	const std::vector<P1_ModuleRange> * pRanges = m_pRanges.load(std::memory_order_acquire);
+	if (dwAddr & P1_ZONE_FLAG) {
+		return P1_INVALID_ID;
+	}
+
+	// last module starting at or below the address
+	std::vector<P1_ModuleRange>::const_iterator it = std::upper_bound(pRanges->begin(), pRanges->end(),
+		dwAddr, CompareAddrRange);
+	if (it == pRanges->begin()) {
+		return P1_INVALID_ID;
+	}
+	--it;
+	if (dwAddr >= it->dwEnd) {
+		return P1_INVALID_ID;
+	}
+	dwOffset = dwAddr - it->dwBase;
+	return it->idModule;
+}
+
+bool P1_ModuleMap::GetModule(unsigned idModule, P1_Module& module)
+{
+	bool bFound = false;
+	Update();
+	EnterCriticalSection(&m_cs);
+	if (idModule < m_vecModules.size()) {
+		module = m_vecModules[idModule];
+		bFound = true;
+	}
+	LeaveCriticalSection(&m_cs);
+	return bFound;
+}
 
-		if (s_pProfiler1->bEnableMemoryProfile){
-			PROCESS_MEMORY_COUNTERS infoPMC;
+std::vector<P1_Module> P1_ModuleMap::GetModules()
+{
+	Update();
+	EnterCriticalSection(&m_cs);
+	std::vector<P1_Module> vecModules = m_vecModules;
+	LeaveCriticalSection(&m_cs);
+	return vecModules;
+}
+
+Profiler1* Profiler1::s_pInstance = new Profiler1;
+Profiler1::GC Profiler1::gc;
+Profiler1* s_pProfiler1 = g_objProfiler1.GetInstancePtr();
+
+void Profiler1::EnterFrame(DWORD64 dwAddr, DWORD64 dwKey)
+{
+	if (GetCurrentThreadId() != dwTargetThread) {
+		return;
+	}
+	size_t szFrame = m_vecFrames.size();
+	if (szFrame <= 0) {
+		return;
+	}
 
-			GetProcessMemoryInfo(GetCurrentProcess(), &infoPMC, sizeof(infoPMC));
-			frame.vecStackFrames[idFrame].unEndMem = infoPMC.WorkingSetSize;
+	P1_FrameData& frame = m_vecFrames[szFrame - 1];
+
+	// a callee is always deeper than its callers, running frames which are not
+	// have been left by an exception or longjmp without calling _pexit
+	size_t szBase = m_vecCoroSegments.empty() ? 0 : m_vecCoroSegments.back().szBase;
+	if (m_stackFrames.size() > szBase && m_stackFrames.top().dwKey <= dwKey) {
+		LARGE_INTEGER UnwindTime;
+		QueryPerformanceCounter(&UnwindTime);
+		while (m_stackFrames.size() > szBase && m_stackFrames.top().dwKey <= dwKey) {
+			EndStackFrame(frame, m_stackFrames.top().id, UnwindTime.QuadPart, true);
+			m_stackFrames.pop();
+			frame.unUnwoundFrames++;
 		}
+	}
+
+	PushFrame(frame, m_registry.GetId(dwAddr, &m_modules), dwAddr, dwKey);
+}
+
+bool Profiler1::EnterZone(P1_ZoneDesc& desc, size_t& szDepth)
+{
+	// other threads must not touch the descriptor or the name table
+	if (GetCurrentThreadId() != dwTargetThread) {
+		return false;
+	}
+	size_t szFrame = m_vecFrames.size();
+	if (szFrame <= 0) {
+		return false;
+	}
+	if (!desc.bRegistered) {
+		RegisterZone(desc);
+	}
+	if (desc.idFunc == P1_INVALID_ID) {
+		desc.idFunc = m_registry.GetId(desc.dwAddr, &m_modules);
+	}
+
+	// nested locals are not laid out in any particular order, so the zone
+	// takes the key of its caller: callees are deeper, and the stack pointer
+	// checks stop at it. The outermost zone of a segment is never unwound.
+	size_t szBase = m_vecCoroSegments.empty() ? 0 : m_vecCoroSegments.back().szBase;
+	DWORD64 dwKey = m_stackFrames.size() > szBase ? m_stackFrames.top().dwKey : ~0ULL;
+	szDepth = m_stackFrames.size() - szBase;
+	PushFrame(m_vecFrames[szFrame - 1], desc.idFunc, desc.dwAddr, dwKey);
+	return true;
+}
+
+void Profiler1::ExitZone(P1_ZoneDesc& desc, size_t szDepth)
+{
+	if (GetCurrentThreadId() != dwTargetThread) {
+		return;
+	}
+	size_t szFrame = m_vecFrames.size();
+	if (szFrame <= 0) {
+		return;
+	}
+
+	LARGE_INTEGER EndTime;
+	QueryPerformanceCounter(&EndTime);
+
+	P1_FrameData& frame = m_vecFrames[szFrame - 1];
+	size_t szBase = m_vecCoroSegments.empty() ? 0 : m_vecCoroSegments.back().szBase;
+	size_t szZone = szBase + szDepth + 1;
+
+	// frames above the zone have missed their exit
+	while (m_stackFrames.size() > szZone) {
+		EndStackFrame(frame, m_stackFrames.top().id, EndTime.QuadPart, true);
+		m_stackFrames.pop();
+		frame.unUnwoundFrames++;
+	}
+
+	if (m_stackFrames.size() == szZone && m_stackFrames.top().dwAddr == desc.dwAddr) {
+		EndStackFrame(frame, m_stackFrames.top().id, EndTime.QuadPart, false);
+		m_stackFrames.pop();
+	} else {
+		// entered before FrameStart, or before the profiler was enabled
+		frame.unOrphanExits++;
+	}
+}
+
+void Profiler1::PushFrame(P1_FrameData& frame, unsigned idFunc, DWORD64 dwAddr, DWORD64 dwKey)
+{
+	unsigned id = (unsigned)frame.stackFrames.size();
+	unsigned idCaller = id;
+
+	if (!m_stackFrames.empty()) {
+		idCaller = m_stackFrames.top().id;
+	}
+
+	unsigned unStartMem = 0;
+	if (bEnableMemoryProfile){
+		PROCESS_MEMORY_COUNTERS infoPMC;
+
+		GetProcessMemoryInfo(GetCurrentProcess(), &infoPMC, sizeof(infoPMC));
+		unStartMem = infoPMC.WorkingSetSize;
+	}
+
+	LARGE_INTEGER StartingTime;
+	QueryPerformanceCounter(&StartingTime);
+
+	frame.stackFrames.push_back(idFunc, idCaller, StartingTime.QuadPart, unStartMem);
+
+	P1_ShadowFrame shadowFrame;
+	shadowFrame.id = id;
+	shadowFrame.dwAddr = dwAddr;
+	shadowFrame.dwKey = dwKey;
+	m_stackFrames.push(shadowFrame);
+}
+
+void Profiler1::ExitFrame(DWORD64 dwAddr, DWORD64 dwKey)
+{
+	if (GetCurrentThreadId() != dwTargetThread) {
+		return;
+	}
+	size_t szFrame = m_vecFrames.size();
+	if (szFrame <= 0) {
+		return;
+	}
+
+	LARGE_INTEGER EndTime;
+	QueryPerformanceCounter(&EndTime);
+
+	P1_FrameData& frame = m_vecFrames[szFrame - 1];
+	size_t szBase = m_vecCoroSegments.empty() ? 0 : m_vecCoroSegments.back().szBase;
+
+	// deeper frames have missed their exit
+	while (m_stackFrames.size() > szBase && m_stackFrames.top().dwKey < dwKey) {
+		EndStackFrame(frame, m_stackFrames.top().id, EndTime.QuadPart, true);
+		m_stackFrames.pop();
+		frame.unUnwoundFrames++;
+	}
+
+	// zones of the function share its key, one still open has been left by
+	// an exception or longjmp, its destructor would have run before _pexit
+	while (m_stackFrames.size() > szBase && m_stackFrames.top().dwKey == dwKey
+		&& (m_stackFrames.top().dwAddr & P1_ZONE_FLAG) != 0) {
+		EndStackFrame(frame, m_stackFrames.top().id, EndTime.QuadPart, true);
+		m_stackFrames.pop();
+		frame.unUnwoundFrames++;
+	}
+
+	// the exit comes from an address after the entry of the function
+	if (m_stackFrames.size() > szBase && m_stackFrames.top().dwKey == dwKey
+		&& dwAddr >= m_stackFrames.top().dwAddr) {
+		EndStackFrame(frame, m_stackFrames.top().id, EndTime.QuadPart, false);
+		m_stackFrames.pop();
+	} else {
+		// entered before FrameStart, or before the profiler was enabled
+		frame.unOrphanExits++;
+	}
+}
+
+void Profiler1::EndStackFrame(P1_FrameData& frame, unsigned idFrame, __int64 i64EndTime, bool bUnwound)
+{
+	P1_StackFrameArrays& stackFrames = frame.stackFrames;
+
+	if (bEnableMemoryProfile){
+		PROCESS_MEMORY_COUNTERS infoPMC;
 
-		LARGE_INTEGER EndTime;
-		QueryPerformanceCounter(&EndTime);
+		GetProcessMemoryInfo(GetCurrentProcess(), &infoPMC, sizeof(infoPMC));
+		stackFrames.vecEndMem[idFrame] = infoPMC.WorkingSetSize;
+	}
+
+	stackFrames.vecEndTime[idFrame] = i64EndTime;
+	stackFrames.vecUnwound[idFrame] = bUnwound ? 1 : 0;
+}
+
+void Profiler1::CoroResume(const void * pCoro)
+{
+	if (GetCurrentThreadId() != dwTargetThread || m_vecFrames.empty()) {
+		return;
+	}
+
+	CoroSegment segment;
+	segment.pCoro = pCoro;
+	segment.szBase = m_stackFrames.size();
+	m_vecCoroSegments.push_back(segment);
+
+	std::map<const void *, std::vector<P1_ShadowFrame>>::iterator it = m_mapCoroStacks.find(pCoro);
+	if (it == m_mapCoroStacks.end()) {
+		return;
+	}
+
+	// start the suspended functions again, under the resumer, with their keys
+	// and depths above the segment base as they were
+	P1_FrameData& frame = m_vecFrames.back();
+	std::vector<P1_ShadowFrame>& vecStack = it->second;
+	for (size_t i = 0; i < vecStack.size(); i++) {
+		PushFrame(frame, m_registry.GetId(vecStack[i].dwAddr, &m_modules), vecStack[i].dwAddr, vecStack[i].dwKey);
+	}
+	m_mapCoroStacks.erase(it);
+}
+
+void Profiler1::CoroLeave(const void * pCoro)
+{
+	if (GetCurrentThreadId() != dwTargetThread || m_vecFrames.empty()) {
+		return;
+	}
+	if (m_vecCoroSegments.empty() || m_vecCoroSegments.back().pCoro != pCoro) {
+		// the segment was dropped by FrameEnd
+		return;
+	}
+	size_t szBase = m_vecCoroSegments.back().szBase;
+	m_vecCoroSegments.pop_back();
+
+	LARGE_INTEGER SuspendTime;
+	QueryPerformanceCounter(&SuspendTime);
+
+	// functions still running in the coroutine are suspended
+	P1_FrameData& frame = m_vecFrames.back();
+	std::vector<P1_ShadowFrame> vecStack;
+	while (m_stackFrames.size() > szBase) {
+		vecStack.push_back(m_stackFrames.top());
+		EndStackFrame(frame, m_stackFrames.top().id, SuspendTime.QuadPart, true);
+		m_stackFrames.pop();
+	}
+
+	if (vecStack.empty()) {
+		m_mapCoroStacks.erase(pCoro);
+	} else {
+		std::reverse(vecStack.begin(), vecStack.end());
+		m_mapCoroStacks[pCoro] = vecStack;
+	}
+}
+
+void Profiler1::RegisterZone(P1_ZoneDesc& desc)
+{
+	// the hash of another name may have taken the id, probe the next ones,
+	// every descriptor of a name walks the same ids and stops at the same one
+	DWORD64 dwId = desc.dwAddr;
+	std::unordered_map<DWORD64, std::string>::iterator it = m_nametable.find(dwId);
+	while (it != m_nametable.end() && it->second != desc.szName) {
+		dwId = ((dwId + 1) & ~P1_ZONE_FLAG) | P1_ZONE_FLAG;
+		it = m_nametable.find(dwId);
+	}
+	if (dwId != desc.dwAddr) {
+		std::stringstream ss;
+		ss << "#warning:Profiler1::RegisterZone: " << desc.szName << ": id " << std::hex
+		<< desc.dwAddr << " is taken by " << m_nametable[desc.dwAddr] << ", using " << dwId << std::endl;
+		m_vecMsgs.push_back(ss.str());
+		desc.dwAddr = dwId;
+	}
+	if (it == m_nametable.end()) {
+		m_nametable[dwId] = desc.szName;
+	}
+	desc.bRegistered = true;
+}
+
+void Profiler1::Counter(P1_ZoneDesc& desc, double dValue)
+{
+	RecordEvent(desc, dValue, false);
+}
+
+void Profiler1::Marker(P1_ZoneDesc& desc)
+{
+	RecordEvent(desc, 0, true);
+}
+
+void Profiler1::RecordEvent(P1_ZoneDesc& desc, double dValue, bool bMarker)
+{
+	if (!g_bEnableProfiler1 || GetCurrentThreadId() != dwTargetThread) {
+		return;
+	}
+	size_t szFrame = m_vecFrames.size();
+	if (szFrame <= 0) {
+		return;
+	}
+	if (!desc.bRegistered) {
+		RegisterZone(desc);
+	}
+
+	P1_Event event;
+	event.dwId = desc.dwAddr;
+	event.dValue = dValue;
+	event.bMarker = bMarker;
+	event.idStackFrame = m_stackFrames.empty() ? P1_NO_STACKFRAME : m_stackFrames.top().id;
+
+	LARGE_INTEGER Time;
+	QueryPerformanceCounter(&Time);
+	event.i64Time = Time.QuadPart;
+
+	m_vecFrames[szFrame - 1].vecEvents.push_back(event);
+}
+
+void Profiler1::FlowSubmit(P1_ZoneDesc& desc, DWORD64 dwFlow)
+{
+	RecordFlow(&desc, dwFlow, P1_FLOW_PHASE_SUBMIT);
+}
+
+void Profiler1::FlowBegin(DWORD64 dwFlow)
+{
+	RecordFlow(NULL, dwFlow, P1_FLOW_PHASE_BEGIN);
+}
+
+void Profiler1::FlowEnd(DWORD64 dwFlow)
+{
+	RecordFlow(NULL, dwFlow, P1_FLOW_PHASE_END);
+}
+
+// buffer of the calling thread, registered on its first flow step
+static __declspec(thread) P1_FlowBuffer * s_pFlowBuffer = NULL;
+
+void Profiler1::RecordFlow(P1_ZoneDesc * pDesc, DWORD64 dwFlow, P1_FlowPhase phase)
+{
+	if (!bStart) {
+		return;
+	}
+	LARGE_INTEGER Time;
+	QueryPerformanceCounter(&Time);
+
+	if (!s_pFlowBuffer) {
+		s_pFlowBuffer = new P1_FlowBuffer;
+		s_pFlowBuffer->dwThreadId = GetCurrentThreadId();
+		EnterCriticalSection(&m_csFlows);
+		m_vecFlowBuffers.push_back(s_pFlowBuffer);
+		LeaveCriticalSection(&m_csFlows);
+	}
+	P1_FlowEvent event;
+	event.dwFlow = dwFlow;
+	event.pDesc = pDesc;
+	event.i64Time = Time.QuadPart;
+	event.dwThreadId = s_pFlowBuffer->dwThreadId;
+	event.phase = phase;
+	// only the target thread has a stack to point at
+	if (event.dwThreadId == dwTargetThread && g_bEnableProfiler1 && !m_vecFrames.empty()) {
+		event.idFrame = (unsigned)m_vecFrames.size() - 1;
+		event.idStackFrame = m_stackFrames.empty() ? P1_NO_STACKFRAME : m_stackFrames.top().id;
+	}
+
+	// uncontended but for Analyze() copying the buffer
+	unsigned unEpoch = m_unFlowEpoch;
+	EnterCriticalSection(&s_pFlowBuffer->cs);
+	if (s_pFlowBuffer->unEpoch != unEpoch) {
+		s_pFlowBuffer->vecEvents.clear();
+		s_pFlowBuffer->unEpoch = unEpoch;
+	}
+	s_pFlowBuffer->vecEvents.push_back(event);
+	LeaveCriticalSection(&s_pFlowBuffer->cs);
+}
+
+// zones are defined here rather than inline in the header, so that they are
+// not instrumented by /Gh /GH in the user's translation unit
+P1_Zone::P1_Zone(P1_ZoneDesc& desc) : m_desc(desc)
+{
+	m_szDepth = 0;
+	m_bActive = g_bEnableProfiler1 && s_pProfiler1->EnterZone(desc, m_szDepth);
+}
+
+P1_Zone::~P1_Zone()
+{
+	if (m_bActive && g_bEnableProfiler1) {
+		s_pProfiler1->ExitZone(m_desc, m_szDepth);
+	}
+}
+
+P1_CoroScope::P1_CoroScope(const void * pCoro)
+{
+	m_pCoro = pCoro;
+	m_bActive = g_bEnableProfiler1;
+	if (m_bActive) {
+		s_pProfiler1->CoroResume(pCoro);
+	}
+}
+
+P1_CoroScope::~P1_CoroScope()
+{
+	if (m_bActive && g_bEnableProfiler1) {
+		s_pProfiler1->CoroLeave(m_pCoro);
+	}
+}
+
+// the /Gh /GH hooks need inline assembly, which only the x86 compiler has.
+// x64 and ARM64 builds record zones and the manual api only.
+#if defined(_M_IX86)
+void _stdcall EnterFunc(unsigned* pStack)
+{
+	void* pCaller = (void*)(pStack[0] - 5);
+
+	// pStack points to the return address of _penter, the stack pointer
+	// at _pexit of the same call is equal
+	s_pProfiler1->EnterFrame((DWORD64)pCaller, (DWORD64)(ULONG_PTR)pStack);
+}
+
+static __declspec(thread) bool bHooking = false;
+
+extern "C" __declspec(naked) void __cdecl _penter()
+{
+	// prolog
+	_asm
+	{
+		pushad              // save all general purpose registers
+	}
+	if (bHooking || !g_bEnableProfiler1) {
+		// epilog
+		_asm {
+			popad
+			ret
+		}
+	}
+	bHooking = true;
+	_asm {
+		mov eax, esp     // current stack pointer
+		add eax, 32      // stack pointer before pushad
+		push eax		 // return address, the address of the function
+		call EnterFunc
+	}
 
-		frame.vecStackFrames[idFrame].i64EndTime = EndTime.QuadPart;
-		s_pProfiler1->m_stackFrames.pop();
+	bHooking = false;
+	// epilog
+	_asm
+	{
+		popad               // restore general purpose registers
+		ret                 // start executing original function
 	}
+}
+
+void _stdcall ExitFunc(unsigned* pStack)
+{
+	// _pexit is called in the epilogue, this is an address inside the function
+	void* pCaller = (void*)(pStack[0] - 5);
 
+	s_pProfiler1->ExitFrame((DWORD64)pCaller, (DWORD64)(ULONG_PTR)pStack);
 }
 
 extern "C" __declspec(naked) void __cdecl _pexit()
@@ -565,3 +3061,4 @@ extern "C" __declspec(naked) void __cdecl _pexit()
 		ret                 // start executing original function
 	}
 }
+#endif
@@ -43,10 +43,33 @@
 #include <unordered_map>
 #include <Windows.h>
 #include <DbgHelp.h>
+#include <malloc.h>
+#include <new>
 #include <map>
 #include <string>
+#include <cstring>
 #include <vector>
 #include <stack>
+#include <type_traits>
+#include <atomic>
+
+/**
+ * @brief Capacity of the function registry, a power of 2.
+ * Functions registered after it is full share the last id.
+ * 
+ */
+#ifndef P1_MAX_FUNCTIONS
+#define P1_MAX_FUNCTIONS 65536
+#endif
+
+#define P1_INVALID_ID 0xFFFFFFFF
+
+/**
+ * @brief Buckets of the self time histogram of a function, bucket 0 counts
+ * calls under 1us, bucket b counts calls of [2^(b-1), 2^b) us
+ * 
+ */
+#define P1_HIST_BUCKETS 32
 
 /**
  * @brief Stack Frame，data of each function execution
@@ -55,6 +78,7 @@
 struct P1_StackFrame {
 	unsigned id;
 	DWORD64 dwAddr;			// address
+	unsigned idFunc;		// dense id of the function, see P1_FunctionRegistry
 	__int64 i64StartTime;
 	__int64 i64EndTime;
 	unsigned unTotalTime;
@@ -63,9 +87,13 @@ struct P1_StackFrame {
 	unsigned unStartMem;	// memory cost before function start
 	unsigned unEndMem;		// memory cost after function start
 	unsigned idCaller;		// caller frame id. if no caller, idCaller = id
+	bool bUnwound;			// ended without its exit hook (exception, longjmp, coroutine suspend)
+	unsigned unRecursionDepth;	// running activations of the same function including this one, set by Analyze()
+	unsigned idPath;		// call path, see P1_CallPath, set by Analyze()
 	P1_StackFrame(){
 		id = 0;
 		dwAddr = 0;
+		idFunc = 0;
 		i64StartTime = 0;
 		i64EndTime = 0;
 		unTotalTime = 0;
@@ -74,49 +102,843 @@ struct P1_StackFrame {
 		unStartMem = 0;
 		unEndMem = 0;
 		idCaller = 0;
+		bUnwound = false;
+		unRecursionDepth = 0;
+		idPath = P1_INVALID_ID;
 	}
 };
 
 /**
- * @brief Data of every function execution between FrameStart and FrameEnd
+ * @brief Allocator of 32 bytes aligned memory, for the vectorized kernels
+ * 
+ */
+template <class T>
+struct P1_AlignedAllocator {
+	typedef T value_type;
+	P1_AlignedAllocator(){}
+	template <class U> P1_AlignedAllocator(const P1_AlignedAllocator<U>&){}
+	T* allocate(size_t n){
+		void * p = _aligned_malloc(n * sizeof(T), 32);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t){
+		_aligned_free(p);
+	}
+	template <class U> bool operator==(const P1_AlignedAllocator<U>&) const { return true; }
+	template <class U> bool operator!=(const P1_AlignedAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using P1_AlignedVector = std::vector<T, P1_AlignedAllocator<T>>;
+
+/**
+ * @brief Stack frames of one frame, every field in its own array indexed by
+ * stack frame id, so Analyze() only reads the fields it needs
+ * 
+ */
+struct P1_StackFrameArrays {
+	P1_AlignedVector<__int64> vecStartTime;
+	P1_AlignedVector<__int64> vecEndTime;
+	P1_AlignedVector<unsigned> vecFuncIds;
+	P1_AlignedVector<unsigned> vecCallerIds;	// if no caller, the stack frame id itself
+	P1_AlignedVector<unsigned> vecStartMem;
+	P1_AlignedVector<unsigned> vecEndMem;
+	P1_AlignedVector<unsigned char> vecUnwound;
+	// set by Analyze()
+	P1_AlignedVector<unsigned> vecTotalTime;
+	P1_AlignedVector<unsigned> vecSubTime;
+	P1_AlignedVector<unsigned> vecSelfTime;
+	P1_AlignedVector<unsigned> vecRecursionDepth;
+	P1_AlignedVector<unsigned> vecPathIds;
+
+	size_t size() const {
+		return vecFuncIds.size();
+	}
+	void push_back(unsigned idFunc, unsigned idCaller, __int64 i64StartTime, unsigned unStartMem){
+		vecStartTime.push_back(i64StartTime);
+		vecEndTime.push_back(0);
+		vecFuncIds.push_back(idFunc);
+		vecCallerIds.push_back(idCaller);
+		vecStartMem.push_back(unStartMem);
+		vecEndMem.push_back(0);
+		vecUnwound.push_back(0);
+	}
+};
+
+/**
+ * @brief Entry of the shadow stack, the running stack frames of the target thread
+ * 
+ */
+struct P1_ShadowFrame {
+	unsigned id;			// stack frame id in the current frame
+	DWORD64 dwAddr;			// address of the function, or id of the zone
+	DWORD64 dwKey;			// stack pointer of the activation, lower is deeper
+	P1_ShadowFrame(){
+		id = 0;
+		dwAddr = 0;
+		dwKey = 0;
+	}
+};
+
+/**
+ * @brief Counter sample or instant marker, see P1_COUNTER and P1_MARKER
+ * 
+ */
+struct P1_Event {
+	DWORD64 dwId;			// interned id of the name
+	__int64 i64Time;
+	double dValue;			// counter value, 0 for marker
+	unsigned idStackFrame;	// innermost running stack frame, P1_NO_STACKFRAME if none
+	bool bMarker;
+	P1_Event(){
+		dwId = 0;
+		i64Time = 0;
+		dValue = 0;
+		idStackFrame = 0;
+		bMarker = false;
+	}
+};
+
+#define P1_NO_STACKFRAME 0xFFFFFFFF
+
+/**
+ * @brief Summary of one frame, between FrameStart and FrameEnd
  * 
  */
-struct P1_Frame {
+struct P1_FrameInfo {
 	unsigned id;
 	__int64 i64StartTime;
 	__int64 i64EndTime;
 	unsigned unStartMem;
 	unsigned unEndMem;
-	std::vector<P1_StackFrame> vecStackFrames;
-	P1_Frame(){
+	std::vector<P1_Event> vecEvents;	// counters and markers, in time order
+	unsigned unUnwoundFrames;	// stack frames ended by unwinding, their exit was never seen
+	unsigned unOrphanExits;		// exits without a matching stack frame
+	P1_FrameInfo(){
 		id = 0;
 		i64StartTime = 0;
 		i64EndTime = 0;
 		unStartMem = 0;
 		unEndMem = 0;
+		unUnwoundFrames = 0;
+		unOrphanExits = 0;
 	}
 };
 
+/**
+ * @brief Data of every function execution between FrameStart and FrameEnd
+ * 
+ */
+struct P1_Frame : public P1_FrameInfo {
+	std::vector<P1_StackFrame> vecStackFrames;
+};
+
+/**
+ * @brief Frame as recorded, stack frames are stored as arrays
+ * 
+ */
+struct P1_FrameData : public P1_FrameInfo {
+	P1_StackFrameArrays stackFrames;
+};
+
 /**
  * @brief Statistic of each function execution
  * 
  */
 struct P1_StatsUnit {
 	DWORD64 dwAddr;
+	unsigned idFunc;
 	unsigned unTotalTime;
 	unsigned unTotalSlefTime;
 	int nTotalMem;
 	unsigned unInvokeTimes;
+	unsigned unRecursiveInvokeTimes;	// invoked while already running, not counted in unTotalTime and nTotalMem
+	unsigned unMaxRecursionDepth;
+	unsigned arrSelfTimeHist[P1_HIST_BUCKETS];	// calls by self time, see P1_HIST_BUCKETS
 	std::string strName;
 	P1_StatsUnit(){
 		dwAddr = 0;
+		idFunc = 0;
 		unTotalTime = 0;
 		unTotalSlefTime = 0;
 		nTotalMem = 0;
 		unInvokeTimes = 0;
+		unRecursiveInvokeTimes = 0;
+		unMaxRecursionDepth = 0;
+		memset(arrSelfTimeHist, 0, sizeof(arrSelfTimeHist));
+	}
+};
+
+/**
+ * @brief Statistic of one function without its name, kept in flat arrays
+ * indexed by function id. One is kept per function and frame, so the self
+ * time histogram is kept apart, for the whole capture only
+ * 
+ */
+struct P1_StatsAccum {
+	unsigned idFunc;
+	unsigned unTotalTime;
+	unsigned unTotalSelfTime;
+	int nTotalMem;
+	unsigned unInvokeTimes;
+	unsigned unRecursiveInvokeTimes;
+	unsigned unMaxRecursionDepth;
+	P1_StatsAccum(){
+		idFunc = 0;
+		unTotalTime = 0;
+		unTotalSelfTime = 0;
+		nTotalMem = 0;
+		unInvokeTimes = 0;
+		unRecursiveInvokeTimes = 0;
+		unMaxRecursionDepth = 0;
+	}
+	void Merge(const P1_StatsAccum& other){
+		unTotalTime += other.unTotalTime;
+		unTotalSelfTime += other.unTotalSelfTime;
+		nTotalMem += other.nTotalMem;
+		unInvokeTimes += other.unInvokeTimes;
+		unRecursiveInvokeTimes += other.unRecursiveInvokeTimes;
+		unMaxRecursionDepth = (std::max)(unMaxRecursionDepth, other.unMaxRecursionDepth);
+	}
+};
+
+/**
+ * @brief A function and the path of its caller, one node of the call tree
+ * merged over all frames
+ * 
+ */
+struct P1_CallPath {
+	unsigned idParent;		// P1_INVALID_ID for a root
+	unsigned idFunc;
+};
+
+/**
+ * @brief A module (exe or dll) loaded into the process
+ * 
+ */
+struct P1_Module {
+	std::string strPath;
+	DWORD64 dwBase;
+	DWORD dwSize;
+	DWORD dwTimeStamp;		// TimeDateStamp of the image, tells builds apart
+	bool bLoaded;			// false once unloaded, its index stays valid
+	P1_Module(){
+		dwBase = 0;
+		dwSize = 0;
+		dwTimeStamp = 0;
+		bLoaded = false;
 	}
 };
 
+/**
+ * @brief Address range of a loaded module
+ * 
+ */
+struct P1_ModuleRange {
+	DWORD64 dwBase;
+	DWORD64 dwEnd;
+	unsigned idModule;
+};
+
+/**
+ * @brief Dll load or unload queued by the dll notification, applied by
+ * P1_ModuleMap::Update()
+ * 
+ */
+#define P1_MODULE_EVENTS 64
+
+struct P1_ModuleEvent {
+	DWORD64 dwBase;
+	DWORD dwSize;
+	bool bLoaded;
+	char szPath[MAX_PATH];
+};
+
+/**
+ * @brief Modules of the process, snapshot by Refresh() and kept up to date
+ * on dll load and unload. Modules only get appended, so a module index
+ * stays valid after the module is unloaded. Find() is lock free, it reads
+ * a sorted range table which is replaced on every change. Dll notifications
+ * arrive with the loader lock held, they are queued and applied by Update().
+ * 
+ */
+class P1_ModuleMap {
+public:
+	P1_ModuleMap();
+	~P1_ModuleMap();
+
+	/**
+	 * @brief Enumerate the modules loaded now
+	 * 
+	 */
+	void Refresh();
+
+	/**
+	 * @brief Add a loaded module / mark a module unloaded
+	 * 
+	 */
+	void AddModule(const std::string& strPath, DWORD64 dwBase, DWORD dwSize);
+	void RemoveModule(DWORD64 dwBase);
+
+	/**
+	 * @brief Queue a dll load / unload, called by the dll notification with
+	 * the loader lock held. It neither allocates nor reads the image.
+	 * 
+	 * @param szPath path of a loaded dll, szLen chars, not terminated
+	 */
+	void Notify(bool bLoaded, DWORD64 dwBase, DWORD dwSize, const WCHAR * szPath, size_t szLen);
+
+	/**
+	 * @brief Apply the queued notifications, cheap when there are none.
+	 * A dll already unloaded again is skipped.
+	 * 
+	 * @param unEvents apply only the events queued before GetNotified() returned this
+	 */
+	void Update(unsigned unEvents = P1_INVALID_ID);
+
+	/**
+	 * @brief Number of notifications queued so far, one atomic load
+	 * 
+	 */
+	unsigned GetNotified() const;
+
+	/**
+	 * @brief Number of modules found unloaded so far
+	 * 
+	 */
+	unsigned GetUnloads() const;
+
+	/**
+	 * @brief Find the loaded module containing the address
+	 * 
+	 * @param dwOffset offset of the address in the module, 0 if not found
+	 * @return unsigned index of the module, P1_INVALID_ID if not found
+	 */
+	unsigned Find(DWORD64 dwAddr, DWORD64& dwOffset) const;
+
+	/**
+	 * @brief Get a module by its index
+	 * 
+	 * @return false if there is no such module
+	 */
+	bool GetModule(unsigned idModule, P1_Module& module);
+
+	/**
+	 * @brief Get every module seen since the process started
+	 * 
+	 */
+	std::vector<P1_Module> GetModules();
+
+private:
+	void Publish();
+	CRITICAL_SECTION m_cs;	// writers and GetModule(s)
+	std::vector<P1_Module> m_vecModules;
+	std::atomic<const std::vector<P1_ModuleRange> *> m_pRanges;
+	std::vector<const std::vector<P1_ModuleRange> *> m_vecRetiredRanges;	// may still be read by Find()
+	P1_ModuleEvent m_arrEvents[P1_MODULE_EVENTS];	// ring, written by Notify()
+	std::atomic<unsigned> m_unNotified;	// events queued by Notify()
+	std::atomic<unsigned> m_unApplied;	// events applied by Update()
+	std::atomic<unsigned> m_unUnloads;
+};
+
+/**
+ * @brief Lock free map from function address (or zone id) to a dense id,
+ * filled by the hooks on the first call of every function
+ * 
+ */
+class P1_FunctionRegistry {
+public:
+	P1_FunctionRegistry();
+
+	/**
+	 * @brief Get the id of the function, register it on first use. Runs in
+	 * the hooks, so the module of a new function is left to Sync()
+	 * 
+	 * @param pModules if set, the module of a new function is looked up by Sync()
+	 * as the map was when the function was registered
+	 */
+	unsigned GetId(DWORD64 dwAddr, const P1_ModuleMap * pModules = NULL);
+
+	/**
+	 * @brief Look up the module of the functions registered since the last call,
+	 * then retire the ids of functions whose module has been unloaded since.
+	 * The next call at such an address gets a new id, with the module loaded
+	 * there now, records of the old id keep the old module.
+	 * 
+	 */
+	void Sync(P1_ModuleMap& modules);
+
+	/**
+	 * @brief Get the address of the function, 0 for the shared overflow id
+	 * 
+	 */
+	DWORD64 GetAddress(unsigned id) const;
+
+	/**
+	 * @brief Get the module of the function, as it was when the function was registered
+	 * 
+	 * @param dwOffset offset of the function in the module
+	 * @return unsigned index of the module in P1_ModuleMap, P1_INVALID_ID if none
+	 */
+	unsigned GetModule(unsigned id, DWORD64& dwOffset) const;
+
+	/**
+	 * @brief Number of ids in use, every id is less than it
+	 * 
+	 */
+	unsigned Size() const;
+
+private:
+	enum { SLOTS = P1_MAX_FUNCTIONS * 2 };	// open addressing, kept half empty
+	std::atomic<DWORD64> m_arrKeys[SLOTS];	// 0 for empty slot
+	std::atomic<unsigned> m_arrIds[SLOTS];	// P1_INVALID_ID until the id is published
+	std::atomic<DWORD64> m_arrAddrs[P1_MAX_FUNCTIONS];	// 0 until written by NewId()
+	unsigned m_arrModules[P1_MAX_FUNCTIONS];
+	unsigned m_arrNotified[P1_MAX_FUNCTIONS];	// module events queued at registration, P1_INVALID_ID for none
+	DWORD64 m_arrOffsets[P1_MAX_FUNCTIONS];
+	std::atomic<bool> m_arrRetired[P1_MAX_FUNCTIONS];	// module unloaded, see Sync()
+	std::atomic<unsigned> m_unSize;
+	unsigned m_unUnloads;	// unloads seen by Sync()
+	unsigned m_unResolved;	// ids below have their module looked up, see Sync()
+	unsigned NewId(DWORD64 dwAddr, const P1_ModuleMap * pModules);
+};
+
+/**
+ * @brief Read only view of a recorded frame, stack frames are assembled on access
+ * 
+ */
+class P1_FrameView {
+public:
+	P1_FrameView(const P1_FrameData& frame, const P1_FunctionRegistry& registry);
+	size_t size() const;
+	P1_StackFrame operator[](size_t i) const;
+	const P1_FrameInfo& info() const;
+private:
+	const P1_FrameData& m_frame;
+	const P1_FunctionRegistry& m_registry;
+};
+
+/**
+ * @brief Vectorized kernels of Analyze(), use AVX2 or NEON when available.
+ * Total time is (end - start) * dTickToUs, 0 if the frame never ended.
+ * Self time is total time - sub time, 0 if negative.
+ * 
+ */
+void P1_ComputeTotalTime(const __int64 * pStartTime, const __int64 * pEndTime, size_t szCount,
+	double dTickToUs, unsigned * pTotalTime);
+void P1_ComputeSelfTime(const unsigned * pTotalTime, const unsigned * pSubTime, size_t szCount,
+	unsigned * pSelfTime);
+
+/**
+ * @brief Frames sampled by Analyze() for the baseline of the outlier report
+ * 
+ */
+#ifndef P1_OUTLIER_SAMPLES
+#define P1_OUTLIER_SAMPLES 1024
+#endif
+
+/**
+ * @brief Self time of one call path in a frame, against its baseline
+ * 
+ */
+struct P1_OutlierPath {
+	unsigned idPath;
+	unsigned unSelfTime;		// in the frame
+	unsigned unBaselineTime;	// median over the frames
+	int nExcessTime;			// unSelfTime - unBaselineTime
+	unsigned unInvokeTimes;		// in the frame
+	P1_OutlierPath(){
+		idPath = 0;
+		unSelfTime = 0;
+		unBaselineTime = 0;
+		nExcessTime = 0;
+		unInvokeTimes = 0;
+	}
+};
+
+/**
+ * @brief Self time of one function in a frame, over all its call paths, against its baseline
+ * 
+ */
+struct P1_OutlierFunction {
+	unsigned idFunc;
+	unsigned unSelfTime;		// in the frame
+	unsigned unBaselineTime;	// median over the frames
+	int nExcessTime;			// unSelfTime - unBaselineTime
+	unsigned unInvokeTimes;		// in the frame
+	P1_OutlierFunction(){
+		idFunc = 0;
+		unSelfTime = 0;
+		unBaselineTime = 0;
+		nExcessTime = 0;
+		unInvokeTimes = 0;
+	}
+};
+
+/**
+ * @brief Why a frame took longer than usual, see GetOutlier()
+ * 
+ */
+struct P1_Outlier {
+	unsigned idFrame;
+	unsigned unTotalTime;
+	unsigned unBaselineTime;	// median time of the frames
+	std::vector<P1_OutlierFunction> vecFunctions;	// functions over their baseline, largest excess first
+	std::vector<P1_OutlierPath> vecPaths;	// paths over their baseline, largest excess first
+	P1_Outlier(){
+		idFrame = 0;
+		unTotalTime = 0;
+		unBaselineTime = 0;
+	}
+};
+
+/**
+ * @brief Aggregate of one counter within a frame
+ * 
+ */
+struct P1_CounterStats {
+	DWORD64 dwId;
+	double dMin;
+	double dMax;
+	double dTotal;
+	double dLast;
+	unsigned unSamples;
+	std::string strName;
+	P1_CounterStats(){
+		dwId = 0;
+		dMin = 0;
+		dMax = 0;
+		dTotal = 0;
+		dLast = 0;
+		unSamples = 0;
+	}
+};
+
+/**
+ * @brief How functions are grouped by GetRollupStatistic. Names are parsed
+ * as undecorated by dbghelp, "std::vector<Foo>::push_back" is in the groups
+ * "std::vector<>::push_back", "std::vector<>" and "std". The text alone can't
+ * tell a namespace from a class, "a::f" is taken as a member of class a and
+ * so is in the global namespace, a free function of namespace a too
+ * 
+ */
+enum P1_RollupKind {
+	P1_ROLLUP_FUNCTION,		// no grouping, every function
+	P1_ROLLUP_TEMPLATE,		// name with the template arguments left out
+	P1_ROLLUP_CLASS,		// enclosing class or namespace
+	P1_ROLLUP_NAMESPACE,	// outermost namespace, of names with two scopes or more
+	P1_ROLLUP_FILE,			// source file, needs line information in the pdb
+	P1_ROLLUP_MODULE,		// exe or dll
+	P1_ROLLUP_KINDS
+};
+
+/**
+ * @brief What a budget limits, see P1_Budget
+ * 
+ */
+enum P1_BudgetKind {
+	P1_BUDGET_SELF_TIME,	// a percentile of the self time of the calls of a function(micro sec)
+	P1_BUDGET_FRAME_TIME,	// total time of a frame(micro sec)
+	P1_BUDGET_FRAME_MEMORY	// memory grown in a frame(bytes), needs bEnableMemoryProfile
+};
+
+/**
+ * @brief A limit a capture must stay within, see AddBudget()
+ * 
+ */
+struct P1_Budget {
+	P1_BudgetKind kind;
+	std::string strName;	// function, for P1_BUDGET_SELF_TIME
+	double dPercentile;		// for P1_BUDGET_SELF_TIME, 100 for the slowest call
+	unsigned unFrame;		// for the frame budgets, P1_INVALID_ID for every frame
+	double dLimit;
+	P1_Budget(){
+		kind = P1_BUDGET_FRAME_TIME;
+		dPercentile = 100;
+		unFrame = P1_INVALID_ID;
+		dLimit = 0;
+	}
+};
+
+/**
+ * @brief Outcome of one budget
+ * 
+ */
+struct P1_BudgetResult {
+	unsigned idBudget;		// index of the budget, as returned by AddBudget()
+	bool bPass;				// false as well when nothing was measured, unSamples is 0
+	double dValue;			// the percentile of self time, or the worst frame
+	unsigned unFrame;		// the worst frame, P1_INVALID_ID for P1_BUDGET_SELF_TIME
+	unsigned unSamples;		// calls or frames checked
+	unsigned unViolations;	// calls or frames over the limit
+	P1_BudgetResult(){
+		idBudget = 0;
+		bPass = false;
+		dValue = 0;
+		unFrame = P1_INVALID_ID;
+		unSamples = 0;
+		unViolations = 0;
+	}
+};
+
+/**
+ * @brief Self time, calls and memory of one function in every frame
+ * 
+ */
+struct P1_Series {
+	std::vector<unsigned> vecSelfTime;		// micro sec, indexed by frame
+	std::vector<unsigned> vecInvokeTimes;
+	std::vector<int> vecMemory;				// bytes
+};
+
+/**
+ * @brief Layout of the file of WriteColumnarStatistic, little endian:
+ * P1_ColumnarHeader
+ * unNames names, each an unsigned length and the chars, every name once
+ * unFunctions P1_ColumnarFunction, indexed by function id
+ * unFrames P1_ColumnarFrame
+ * a block per unBlockFrames frames: unsigned count of functions called in
+ *     the block, their ids ascending, then the columns self time, invoke
+ *     times and memory, each a run of the block's frames per function
+ * DWORD64 offset of every block, then DWORD64 offset of this index
+ * 
+ */
+#define P1_COLUMNAR_MAGIC 0x53433150	// "P1CS"
+#define P1_COLUMNAR_VERSION 1
+#define P1_COLUMNAR_COLUMNS 3
+
+struct P1_ColumnarHeader {
+	DWORD dwMagic;
+	DWORD dwVersion;
+	unsigned unFrames;
+	unsigned unFunctions;
+	unsigned unNames;
+	unsigned unBlockFrames;
+};
+
+struct P1_ColumnarFunction {
+	DWORD64 dwAddr;
+	unsigned idName;		// index of the name
+	unsigned idModule;		// index in WriteModuleMap, P1_INVALID_ID if none
+};
+
+struct P1_ColumnarFrame {
+	__int64 i64StartTime;	// micro sec since Start
+	unsigned unTotalTime;	// micro sec
+	int nTotalMem;			// bytes
+};
+
+/**
+ * @brief Layout of the live view, a shared memory segment named
+ * "Local\Profiler1_<process id>" updated after every FrameEnd, see p1top
+ * 
+ */
+#define P1_LIVE_MAGIC 0x32564C3150ULL	// "P1LV2"
+#define P1_LIVE_FRAMES 256		// frame summaries kept, a ring indexed by frame id
+#define P1_LIVE_TOP 32			// functions published, by self time since Start
+#define P1_LIVE_NAME 96
+
+struct P1_LiveFrame {
+	unsigned id;
+	unsigned unTotalTime;		// micro sec
+	int nTotalMem;
+	unsigned unStackFrames;
+	unsigned unMarkers;
+};
+
+struct P1_LiveFunction {
+	unsigned unTotalSelfTime;	// since Start
+	unsigned unInvokeTimes;		// since Start
+	unsigned unFrameSelfTime;	// in the last frame
+	unsigned unFrameTotalTime;	// in the last frame
+	unsigned unFrameInvokeTimes;	// in the last frame
+	DWORD64 dwAddr;				// address of the function, looked up by the reader
+	char szName[P1_LIVE_NAME];	// name of a zone, empty for a function
+};
+
+struct P1_LiveView {
+	DWORD64 dwMagic;
+	DWORD dwProcessId;
+	volatile LONG lSequence;	// seqlock, odd while the profiler is writing
+	unsigned unFrames;			// frames published since Start
+	unsigned unFunctions;		// valid entries of arrFunctions
+	P1_LiveFrame arrFrames[P1_LIVE_FRAMES];
+	P1_LiveFunction arrFunctions[P1_LIVE_TOP];
+};
+
+/**
+ * @brief Zone ids have the highest bit set, so they never collide with
+ * the address of an instrumented function
+ * 
+ */
+#define P1_ZONE_FLAG 0x8000000000000000ULL
+
+/**
+ * @brief FNV-1a hash of a name, evaluated at compile time
+ * 
+ */
+constexpr DWORD64 P1_HashName(const char * szName, DWORD64 dwHash = 14695981039346656037ULL) {
+	return *szName ? P1_HashName(szName + 1, (dwHash ^ (unsigned char)*szName) * 1099511628211ULL) : dwHash;
+}
+
+/**
+ * @brief Id of a zone, zones with the same name share one id. A name whose
+ * hash is taken by another name is moved to a free id when it is registered
+ * 
+ */
+constexpr DWORD64 P1_ZoneId(const char * szName) {
+	return P1_HashName(szName) | P1_ZONE_FLAG;
+}
+
+/**
+ * @brief Static descriptor of a zone, counter or marker, created by P1_ZONE,
+ * P1_COUNTER or P1_MARKER
+ * 
+ */
+struct P1_ZoneDesc {
+	const char * szName;
+	DWORD64 dwAddr;			// interned zone id, recorded as the address of the frame
+	bool bRegistered;		// name has been added to the name table
+	unsigned idFunc;		// dense function id, resolved on the first entry of a zone
+};
+
+/**
+ * @brief Step of a task handed from one thread to another, see P1_FLOW_SUBMIT
+ * 
+ */
+enum P1_FlowPhase {
+	P1_FLOW_PHASE_SUBMIT,
+	P1_FLOW_PHASE_BEGIN,
+	P1_FLOW_PHASE_END
+};
+
+/**
+ * @brief Flow step as recorded, by any thread
+ * 
+ */
+struct P1_FlowEvent {
+	DWORD64 dwFlow;			// id of the task, given by the caller
+	P1_ZoneDesc * pDesc;	// name of the task, set on submit
+	__int64 i64Time;
+	DWORD dwThreadId;
+	unsigned idFrame;		// running frame, if recorded by the target thread
+	unsigned idStackFrame;	// innermost running stack frame, if recorded by the target thread
+	P1_FlowPhase phase;
+	P1_FlowEvent(){
+		dwFlow = 0;
+		pDesc = NULL;
+		i64Time = 0;
+		dwThreadId = 0;
+		idFrame = P1_INVALID_ID;
+		idStackFrame = P1_NO_STACKFRAME;
+		phase = P1_FLOW_PHASE_SUBMIT;
+	}
+};
+
+/**
+ * @brief Flow steps of one thread, only written by that thread. Analyze()
+ * may copy them while the thread still records, so both hold cs
+ * 
+ */
+struct P1_FlowBuffer {
+	DWORD dwThreadId;
+	unsigned unEpoch;		// events of an older capture are dropped
+	std::vector<P1_FlowEvent> vecEvents;
+	CRITICAL_SECTION cs;	// unEpoch, vecEvents
+	P1_FlowBuffer(){
+		dwThreadId = 0;
+		unEpoch = 0;
+		InitializeCriticalSection(&cs);
+	}
+	~P1_FlowBuffer(){
+		DeleteCriticalSection(&cs);
+	}
+};
+
+/**
+ * @brief A task from its submit to its end, linked by Analyze()
+ * 
+ */
+struct P1_Flow {
+	DWORD64 dwFlow;
+	DWORD64 dwId;			// interned id of the name, 0 if never submitted
+	DWORD dwSubmitThread;
+	DWORD dwWorkerThread;
+	__int64 i64SubmitTime;	// 0 if not recorded
+	__int64 i64BeginTime;	// 0 if not recorded
+	__int64 i64EndTime;		// 0 if not recorded
+	unsigned unQueueTime;	// from submit to begin(micro sec)
+	unsigned unRunTime;		// from begin to end(micro sec)
+	unsigned idFrame;		// frame running at the submit, P1_INVALID_ID if none
+	unsigned idPath;		// call path of the submitter, P1_INVALID_ID if unknown
+	unsigned idParent;		// flow running on the submitting thread, P1_INVALID_ID if none
+	P1_Flow(){
+		dwFlow = 0;
+		dwId = 0;
+		dwSubmitThread = 0;
+		dwWorkerThread = 0;
+		i64SubmitTime = 0;
+		i64BeginTime = 0;
+		i64EndTime = 0;
+		unQueueTime = 0;
+		unRunTime = 0;
+		idFrame = P1_INVALID_ID;
+		idPath = P1_INVALID_ID;
+		idParent = P1_INVALID_ID;
+	}
+};
+
+/**
+ * @brief Tasks submitted from one call path, their wait in the queue and
+ * the time the workers spent on them
+ * 
+ */
+struct P1_FlowStats {
+	unsigned idPath;		// P1_INVALID_ID for tasks of unknown submitter
+	unsigned unTasks;
+	__int64 i64TotalQueueTime;
+	__int64 i64TotalRunTime;
+	unsigned unMaxQueueTime;
+	P1_FlowStats(){
+		idPath = P1_INVALID_ID;
+		unTasks = 0;
+		i64TotalQueueTime = 0;
+		i64TotalRunTime = 0;
+		unMaxQueueTime = 0;
+	}
+};
+
+/**
+ * @brief RAII scope recorded like an instrumented function, see P1_ZONE
+ * 
+ */
+class P1_Zone {
+public:
+	explicit P1_Zone(P1_ZoneDesc& desc);
+	~P1_Zone();
+private:
+	P1_ZoneDesc& m_desc;
+	size_t m_szDepth;		// shadow stack depth at the entry, above the coroutine base
+	bool m_bActive;
+};
+
+/**
+ * @brief RAII scope around the resume of a stackful coroutine or fiber,
+ * see P1_CORO_SCOPE
+ * 
+ */
+class P1_CoroScope {
+public:
+	explicit P1_CoroScope(const void * pCoro);
+	~P1_CoroScope();
+private:
+	const void * m_pCoro;
+	bool m_bActive;
+};
+
 /**
  * @brief Profiler1, a profiler to find out the time & memory cost 
  * of function calls.
@@ -196,6 +1018,152 @@ public:
 	 */
 	bool WriteStatistic(const char * filename, unsigned unFrame);
 
+	/**
+	 * @brief Get the statistic data of every group of functions, should call after Analyze().
+	 * Groups are added up from the statistic of each function, the group of a
+	 * function is parsed once and cached. Total time and memory count a call
+	 * inside another call of the same group in both.
+	 * 
+	 * @param kind how functions are grouped
+	 * @return std::vector<StatsUnit> one per group, strName is the group, idFunc is P1_INVALID_ID
+	 */
+	std::vector<P1_StatsUnit> GetRollupStatistic(P1_RollupKind kind);
+
+	/**
+	 * @brief Get the statistic data of every group of functions in targe frame, should call after Analyze()
+	 * 
+	 * @param unFrame targe frame number
+	 */
+	std::vector<P1_StatsUnit> GetRollupStatistic(P1_RollupKind kind, unsigned unFrame);
+
+	/**
+	 * @brief Save the statistic data of every group of functions to file, in the
+	 * columns of WriteStatistic, should call after Analyze()
+	 * 
+	 * @param filename 
+	 */
+	bool WriteRollupStatistic(const char * filename, P1_RollupKind kind);
+	bool WriteRollupStatistic(const char * filename, P1_RollupKind kind, unsigned unFrame);
+
+	/**
+	 * @brief Get the group of a function, see P1_RollupKind
+	 * 
+	 * @param idFunc id of the function, see P1_StatsUnit
+	 */
+	std::string GetRollupName(unsigned idFunc, P1_RollupKind kind);
+
+	/**
+	 * @brief Save the statistic data of every call path to file, should call after Analyze().
+	 * Paths are written folded, names of the callers and the function separated by ';'
+	 * 
+	 * @param filename 
+	 * @param kind group of the functions in the paths, the paths of the same groups are added up
+	 */
+	bool WriteCallPathStatistic(const char * filename, P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Get the folded name of a call path, "caller;...;function"
+	 * 
+	 * @param kind group of the functions, see P1_RollupKind
+	 */
+	std::string GetCallPathName(unsigned idPath, P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Save every module seen since the process started, with its path,
+	 * base address, size and time stamp. With the Module and Offset columns of
+	 * WriteStatistic, functions can be symbolized after the process exited.
+	 * 
+	 * @param filename
+	 */
+	bool WriteModuleMap(const char * filename);
+
+	/**
+	 * @brief Get the frames slower than dOutlierPercentile of all frames or more than
+	 * dOutlierMADs median absolute deviations over the median frame, should call after Analyze()
+	 * 
+	 * @return std::vector<unsigned> frame numbers
+	 */
+	std::vector<unsigned> GetOutlierFrames();
+
+	/**
+	 * @brief Get the functions and call paths which made targe frame slower than usual,
+	 * against the median self time of every function and path, should call after Analyze()
+	 * 
+	 * @param unFrame targe frame number, outlier or not
+	 * @return P1_Outlier 
+	 */
+	P1_Outlier GetOutlier(unsigned unFrame);
+
+	/**
+	 * @brief Save the attribution of every outlier frame to file, should call after Analyze()
+	 * 
+	 * @param filename
+	 * @param unTop functions and paths written per frame, each
+	 * @param kind group of the functions, the functions and paths of a group are
+	 * added up and ranked against the baseline of the group
+	 */
+	bool WriteOutlierReport(const char * filename, unsigned unTop = 10, P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Get every task recorded with P1_FLOW_*, in submit order, should call after Analyze()
+	 * 
+	 * @return std::vector<P1_Flow> 
+	 */
+	std::vector<P1_Flow> GetFlows();
+
+	/**
+	 * @brief Get the tasks of every submitting call path, the most run time first,
+	 * should call after Analyze(). Tasks submitted by a task inherit its path.
+	 * 
+	 * @return std::vector<P1_FlowStats> 
+	 */
+	std::vector<P1_FlowStats> GetFlowStatistic();
+
+	/**
+	 * @brief Save the tasks of every submitting call path to file, should call after Analyze()
+	 * 
+	 * @param filename
+	 * @param kind group of the functions in the paths, the paths of the same groups are added up
+	 */
+	bool WriteFlowStatistic(const char * filename, P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Add a budget, checked by CheckBudgets(). The Add*Budget helpers
+	 * fill a P1_Budget of their kind.
+	 * 
+	 * @return unsigned id of the budget, the index of its result
+	 */
+	unsigned AddBudget(const P1_Budget& budget);
+	unsigned AddSelfTimeBudget(const char * szFunction, double dPercentile, double dLimit);
+	unsigned AddFrameTimeBudget(double dLimit, unsigned unFrame = P1_INVALID_ID);
+	unsigned AddFrameMemoryBudget(double dLimit, unsigned unFrame = P1_INVALID_ID);
+	void ClearBudgets();
+
+	/**
+	 * @brief Check every budget against the capture, should call after Analyze().
+	 * Calls of every function named by a budget are gathered in one pass. A budget
+	 * with no call or frame to check fails, a misspelt name can't pass silently.
+	 * 
+	 * @return std::vector<P1_BudgetResult> indexed by budget id
+	 */
+	std::vector<P1_BudgetResult> CheckBudgets();
+
+	/**
+	 * @brief Check the frame budgets against one frame, may call after its
+	 * FrameEnd, before Analyze(). Self time budgets are left out.
+	 * 
+	 * @param unFrame targe frame number
+	 * @return std::vector<P1_BudgetResult> results of the frame budgets
+	 */
+	std::vector<P1_BudgetResult> CheckFrameBudgets(unsigned unFrame);
+
+	/**
+	 * @brief Check every budget and save the results as json, should call after Analyze()
+	 * 
+	 * @param filename
+	 */
+	bool WriteBudgetReport(const char * filename);
+
 	/**
 	 * @brief Save the statistic data of each frame to file, should call after Analyze()
 	 * 
@@ -203,6 +1171,78 @@ public:
 	 */
 	bool WriteFrameStatistic(const char * filename);
 
+	/**
+	 * @brief Save self time, calls and memory of every function in every frame,
+	 * as a function x frame matrix in blocks of frames, with each name stored
+	 * once, see P1_COLUMNAR_MAGIC. Written in one pass over the frames, should
+	 * call after Analyze(). Read it back with p1stats series.
+	 * 
+	 * @param filename
+	 * @param unBlockFrames frames per block
+	 * @param kind functions of a group are written under the name of the group
+	 */
+	bool WriteColumnarStatistic(const char * filename, unsigned unBlockFrames = 256,
+		P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Get self time, calls and memory of one function in every frame, should call after Analyze()
+	 * 
+	 * @param idFunc id of the function, see P1_StatsUnit
+	 * @return P1_Series 
+	 */
+	P1_Series GetSeries(unsigned idFunc);
+
+	/**
+	 * @brief Get the aggregate of every counter of targe frame, should call after Analyze()
+	 * 
+	 * @param unFrame targe frame number
+	 * @return std::vector<P1_CounterStats> 
+	 */
+	std::vector<P1_CounterStats> GetCounterStatistic(unsigned unFrame);
+
+	/**
+	 * @brief Save function calls, counters and markers of every frame as a
+	 * timeline in chrome trace event format (chrome://tracing, perfetto).
+	 * Tasks are drawn on their worker threads, with an arrow from the submit.
+	 * 
+	 * @param filename
+	 * @param kind calls are named by this group of their function
+	 */
+	bool WriteTimeline(const char * filename, P1_RollupKind kind = P1_ROLLUP_FUNCTION);
+
+	/**
+	 * @brief Publish a summary of every frame and the hottest functions to
+	 * shared memory, for p1top. Off by default, it costs a pass over the
+	 * stack frames of the frame in every FrameEnd. Functions are published
+	 * by address, p1top resolves their names.
+	 * 
+	 * @return false if the shared memory could not be created
+	 */
+	bool OpenLiveView();
+	void CloseLiveView();
+
+	/**
+	 * @brief Record a sample of a named counter, see P1_COUNTER
+	 * 
+	 */
+	void Counter(P1_ZoneDesc& desc, double dValue);
+
+	/**
+	 * @brief Record an instant marker, see P1_MARKER
+	 * 
+	 */
+	void Marker(P1_ZoneDesc& desc);
+
+	/**
+	 * @brief Record the submit, begin and end of a task, from any thread,
+	 * see P1_FLOW_SUBMIT, P1_FLOW_BEGIN and P1_FLOW_END
+	 * 
+	 * @param dwFlow id of the task, unique among the tasks queued or running
+	 */
+	void FlowSubmit(P1_ZoneDesc& desc, DWORD64 dwFlow);
+	void FlowBegin(DWORD64 dwFlow);
+	void FlowEnd(DWORD64 dwFlow);
+
 	/**
 	 * @brief Get the whole collected data, seperated by frames, should call after Analyze()
 	 * 
@@ -210,6 +1250,14 @@ public:
 	 */
 	std::vector<P1_Frame> GetFrames();
 
+	/**
+	 * @brief Get a view of targe frame without copying it, should call after Analyze()
+	 * 
+	 * @param unFrame targe frame number, less than m_vecFrames.size()
+	 * @return P1_FrameView 
+	 */
+	P1_FrameView GetFrameView(unsigned unFrame);
+
 	/**
 	 * @brief Set the thread id to be record
 	 * 
@@ -224,22 +1272,187 @@ public:
 	 */
 	std::string GetFunctionName(DWORD64 dwAddr);
 
+	/**
+	 * @brief Get the loaded module containing the address, and the offset of
+	 * the address in it, which stays the same in every process of the module
+	 * 
+	 * @param dwAddr the address
+	 * @param dwOffset offset from the module base, 0 if not in a module
+	 * @return std::string file name of the module, empty for zones
+	 */
+	std::string GetModuleName(DWORD64 dwAddr, DWORD64& dwOffset);
+
+	/**
+	 * @brief Get the source file of the function by its address
+	 * 
+	 * @param dwAddr the address
+	 * @return std::string path of the file, empty without line information
+	 */
+	std::string GetSourceFile(DWORD64 dwAddr);
+
+	/**
+	 * @brief Push a stack frame of the function at dwAddr, called by the hooks.
+	 * Running frames at or below dwKey were left without their exit (exception,
+	 * longjmp), they are ended first.
+	 * 
+	 * @param dwAddr address of the function
+	 * @param dwKey stack pointer of the activation
+	 */
+	void EnterFrame(DWORD64 dwAddr, DWORD64 dwKey);
+
+	/**
+	 * @brief End the stack frame entered with dwKey, called by the hooks.
+	 * Deeper frames and zones of the function still running are ended as
+	 * unwound, an exit without a matching frame is counted and ignored.
+	 * 
+	 * @param dwAddr address inside the function
+	 * @param dwKey stack pointer of the activation
+	 */
+	void ExitFrame(DWORD64 dwAddr, DWORD64 dwKey);
+
+	/**
+	 * @brief Push a stack frame of the zone, called by P1_Zone. Other threads are ignored.
+	 * Zones are closed by entry order rather than by stack pointer: the frame
+	 * takes the key of its caller, so EnterFrame / ExitFrame never unwind it.
+	 * 
+	 * @param szDepth receives the depth of the zone, to be passed to ExitZone
+	 * @return false if no frame is running or not called on the target thread
+	 */
+	bool EnterZone(P1_ZoneDesc& desc, size_t& szDepth);
+
+	/**
+	 * @brief End the zone entered at szDepth, frames still running above it
+	 * are ended as unwound
+	 * 
+	 */
+	void ExitZone(P1_ZoneDesc& desc, size_t szDepth);
+
+	/**
+	 * @brief Enter / leave a coroutine, see P1_CORO_SCOPE
+	 * 
+	 */
+	void CoroResume(const void * pCoro);
+	void CoroLeave(const void * pCoro);
+
+	/**
+	 * @brief Add the name of a zone to the name table, called on its first record.
+	 * If the id belongs to another name, the descriptor takes the next free id
+	 * 
+	 */
+	void RegisterZone(P1_ZoneDesc& desc);
+
 	/**
 	 * @brief Set true to record memory cost, default is false
 	 * 
 	 */
 	bool bEnableMemoryProfile;
+
+	/**
+	 * @brief Frames slower than this percentile of all frames are outliers, default is 95
+	 * 
+	 */
+	double dOutlierPercentile;
+
+	/**
+	 * @brief Frames more than this many median absolute deviations over the median frame
+	 * are outliers too, default is 3. Catches the slow frames of short captures, where
+	 * the percentile is the slowest frame itself. The deviation is taken as at least 5% of
+	 * the median frame
+	 * 
+	 */
+	double dOutlierMADs;
 	DWORD dwTargetThread;
 	__int64 i64StartTime;
 	__int64 i64Frequency;
-	std::vector<P1_Frame> m_vecFrames;
-	std::stack<unsigned> m_stackFrames;
+	std::vector<P1_FrameData> m_vecFrames;
+	std::stack<P1_ShadowFrame> m_stackFrames;
 	std::vector<std::string> m_vecMsgs;
-	std::map<DWORD64, P1_StatsUnit> m_mapStats;
-	std::vector<std::map<DWORD64, P1_StatsUnit>> m_vecStats;
+	P1_FunctionRegistry m_registry;
+	P1_ModuleMap m_modules;
+	std::vector<P1_StatsAccum> m_vecStats;	// indexed by function id
+	std::vector<std::vector<P1_StatsAccum>> m_vecFrameStats;	// per frame, sorted by function id
+	std::vector<std::map<DWORD64, P1_CounterStats>> m_vecCounterStats;
+	std::vector<P1_CallPath> m_vecPaths;	// indexed by path id
+	std::vector<P1_StatsAccum> m_vecPathStats;	// indexed by path id, idFunc is the function of the path
+	std::vector<unsigned> m_vecSelfTimeHist;	// P1_HIST_BUCKETS per function id, the whole capture
+	std::vector<unsigned> m_vecPathSelfTimeHist;	// P1_HIST_BUCKETS per path id
+	std::vector<P1_Flow> m_vecFlows;	// in submit order
+	std::vector<P1_FlowStats> m_vecFlowStats;
 private:
+	void RecordEvent(P1_ZoneDesc& desc, double dValue, bool bMarker);
+	void RecordFlow(P1_ZoneDesc * pDesc, DWORD64 dwFlow, P1_FlowPhase phase);
+	void AnalyzeFlows();
+	unsigned FindFrame(__int64 i64Time);
+	void CheckFrameBudget(const P1_Budget& budget, unsigned unFrame, P1_BudgetResult& result);
+	std::vector<P1_Budget> m_vecBudgets;	// indexed by budget id
+	CRITICAL_SECTION m_csFlows;	// m_vecFlowBuffers
+	std::vector<P1_FlowBuffer *> m_vecFlowBuffers;	// one per thread which recorded a flow step
+	std::atomic<unsigned> m_unFlowEpoch;	// increased by Start()
+	void PushFrame(P1_FrameData& frame, unsigned idFunc, DWORD64 dwAddr, DWORD64 dwKey);
+	void EndStackFrame(P1_FrameData& frame, unsigned idFrame, __int64 i64EndTime, bool bUnwound);
+
+	/**
+	 * @brief A coroutine running on top of the shadow stack, frames below
+	 * szBase belong to its resumer
+	 */
+	struct CoroSegment {
+		const void * pCoro;
+		size_t szBase;
+	};
+	std::vector<CoroSegment> m_vecCoroSegments;
+	std::map<const void *, std::vector<P1_ShadowFrame>> m_mapCoroStacks;	// stacks of suspended coroutines
+	std::vector<unsigned> m_vecActiveCalls;	// running activations of each function, used by Analyze()
+	std::vector<unsigned> m_vecFrameRows;	// row of each function in the frame being analyzed
 	bool WriteStatistic(std::vector<P1_StatsUnit>& vecStats, const char * filename);
-	void StatsCall(unsigned unFrame, P1_StackFrame& frame);
+	std::vector<P1_StatsUnit> GetStatistic(const P1_StatsAccum * pStats, size_t szStats, const unsigned * pHist);	// pHist indexed by function id, may be NULL
+	std::vector<P1_StatsUnit> GetRollupStatistic(const P1_StatsAccum * pStats, size_t szStats, const unsigned * pHist, P1_RollupKind kind);
+
+	/**
+	 * @brief Group of every function id for one P1_RollupKind, extended as
+	 * functions are registered, kept across captures
+	 */
+	struct RollupIndex {
+		std::vector<unsigned> vecGroups;	// indexed by function id
+		std::vector<std::string> vecNames;	// indexed by group
+		std::unordered_map<std::string, unsigned> mapNames;
+	};
+	RollupIndex m_arrRollups[P1_ROLLUP_KINDS];
+	RollupIndex& GetRollupIndex(P1_RollupKind kind);
+	std::string GetGroupName(unsigned idFunc, P1_RollupKind kind);	// function name for P1_ROLLUP_FUNCTION
+	void AnalyzeFrame(P1_FrameData& frame, std::vector<P1_StatsAccum>& vecRow, bool bInternPaths = true);
+	void StatsCall(std::vector<P1_StatsAccum>& vecRow, P1_StackFrameArrays& stackFrames, unsigned idFrame);
+	void StatsCounter(std::map<DWORD64, P1_CounterStats>& counters, P1_Event& event);
+	void PublishLiveView(P1_FrameData& frame);
+	std::string GetModuleTitle(unsigned idModule);
+	void AnalyzeOutliers();
+	unsigned GetFrameTime(const P1_FrameInfo& frame);
+	size_t GetFramePaths(unsigned unFrame);
+
+	/**
+	 * @brief Self time and calls of the functions and paths of a frame added up by
+	 * group, an empty group table keeps every function or path on its own
+	 */
+	void GetFrameGroups(unsigned unFrame, const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+		std::vector<P1_OutlierFunction>& vecFunctions, std::vector<P1_OutlierPath>& vecPaths);
+	void GetBaselines(const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+		std::vector<unsigned>& vecFuncBaseline, std::vector<unsigned>& vecPathBaseline);	// sized by the caller, per group
+	P1_Outlier RankOutlier(unsigned unFrame, const std::vector<unsigned>& vecFuncGroups, const std::vector<unsigned>& vecPathGroups,
+		const std::vector<unsigned>& vecFuncBaseline, const std::vector<unsigned>& vecPathBaseline);
+	std::vector<unsigned> m_vecOutlierFrames;
+	std::vector<unsigned> m_vecPathBaseline;	// median self time per frame, indexed by path id
+	std::vector<unsigned> m_vecFunctionBaseline;	// median self time per frame, indexed by function id
+	unsigned m_unBaselineFrameTime;
+	std::vector<P1_OutlierPath> m_vecFramePaths;	// self time of the paths of one frame, filled by GetFramePaths()
+	std::vector<unsigned> m_vecPathRows;	// row of each path in m_vecFramePaths
+	unsigned InternPath(unsigned idParent, unsigned idFunc);
+	std::unordered_map<DWORD64, unsigned> m_mapPathIds;	// (parent path id, function id) to path id
+
+	HANDLE m_hLiveMapping;
+	P1_LiveView * m_pLiveView;
+	std::vector<P1_StatsAccum> m_vecLiveStats;	// since Start, indexed by function id
+	std::vector<P1_StatsAccum> m_vecLiveRow;	// last frame
+	std::vector<std::pair<unsigned, unsigned>> m_vecLiveTop;	// (self time, id) min-heap of the P1_LIVE_TOP hottest
+	std::vector<bool> m_vecLiveInTop;	// indexed by function id
 
 	Profiler1();
 	class GC {
@@ -249,7 +1462,8 @@ private:
 	static GC gc;
 	static Profiler1* s_pInstance;
 
-	bool bStart;
+	std::atomic<bool> bStart;	// read by RecordFlow() on any thread
+	PVOID m_pDllNotificationCookie;
 	PSYMBOL_INFO pSymbol;
 	std::unordered_map<DWORD64, std::string> m_nametable;
 	char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(TCHAR)];
@@ -261,5 +1475,83 @@ private:
  */
 #define g_objProfiler1 Profiler1::GetInstance()
 
+#define P1_CONCAT_(a, b) a##b
+#define P1_CONCAT(a, b) P1_CONCAT_(a, b)
+
+/**
+ * @brief Profile the enclosing scope as if it were an instrumented function,
+ * works without /Gh /GH. The name is hashed at compile time, zones with the
+ * same name are merged in the statistic.
+ * 
+ * Example:
+ *     void Update() {
+ *         P1_ZONE("Update");
+ *         // ...
+ *     }
+ */
+#define P1_ZONE(name) P1_ZONE_(name, __COUNTER__)
+#define P1_ZONE_(name, n) \
+	static P1_ZoneDesc P1_CONCAT(s_p1ZoneDesc, n) = \
+		{ name, std::integral_constant<DWORD64, P1_ZoneId(name)>::value, false, P1_INVALID_ID }; \
+	P1_Zone P1_CONCAT(p1Zone, n)(P1_CONCAT(s_p1ZoneDesc, n))
+
+/**
+ * @brief Wrap the resume of a stackful coroutine or fiber, so its stack is
+ * tracked as a separate logical stack. Functions still running in the
+ * coroutine when the scope ends are suspended: they are ended, and started
+ * again under the resumer the next time the coroutine is resumed.
+ * Stackless c++20 coroutines return from every resume and need no scope.
+ * 
+ * Example:
+ *     {
+ *         P1_CORO_SCOPE(pFiber);
+ *         SwitchToFiber(pFiber);
+ *     }
+ */
+#define P1_CORO_SCOPE(pCoro) \
+	P1_CoroScope P1_CONCAT(p1CoroScope, __COUNTER__)((const void *)(pCoro))
+
+/**
+ * @brief Record a sample of a named counter (queue depth, batch size...),
+ * aggregated per frame as min/max/avg/last
+ * 
+ */
+#define P1_COUNTER(name, val) do { \
+	static P1_ZoneDesc s_p1CounterDesc = \
+		{ name, std::integral_constant<DWORD64, P1_ZoneId(name)>::value, false, P1_INVALID_ID }; \
+	g_objProfiler1.Counter(s_p1CounterDesc, (double)(val)); \
+} while (0)
+
+/**
+ * @brief Record an instant marker on the timeline
+ * 
+ */
+#define P1_MARKER(name) do { \
+	static P1_ZoneDesc s_p1MarkerDesc = \
+		{ name, std::integral_constant<DWORD64, P1_ZoneId(name)>::value, false, P1_INVALID_ID }; \
+	g_objProfiler1.Marker(s_p1MarkerDesc); \
+} while (0)
+
+/**
+ * @brief Follow a task through a thread pool. Submit where the task is
+ * queued, begin and end around its run on the worker. Analyze() links the
+ * steps by flow id, the worker time is counted to the submitting call path.
+ * 
+ * Example:
+ *     P1_FLOW_SUBMIT("decode", pTask);
+ *     queue.push(pTask);
+ *     ...
+ *     P1_FLOW_BEGIN(pTask);
+ *     pTask->Run();
+ *     P1_FLOW_END(pTask);
+ */
+#define P1_FLOW_SUBMIT(name, flow) do { \
+	static P1_ZoneDesc s_p1FlowDesc = \
+		{ name, std::integral_constant<DWORD64, P1_ZoneId(name)>::value, false, P1_INVALID_ID }; \
+	g_objProfiler1.FlowSubmit(s_p1FlowDesc, (DWORD64)(flow)); \
+} while (0)
+
+#define P1_FLOW_BEGIN(flow) g_objProfiler1.FlowBegin((DWORD64)(flow))
+#define P1_FLOW_END(flow) g_objProfiler1.FlowEnd((DWORD64)(flow))
 
 
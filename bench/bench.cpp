@@ -0,0 +1,206 @@
+﻿// bench.cpp: benchmark of the analysis of profiler1
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* bench [frames] [calls per frame]
+* records a synthetic capture, then compares the wall time of the analysis
+* on the stack frame arrays with the same analysis on structs of the original
+* P1_StackFrame layout.
+**/
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include "..\Profiler1\profiler1.h"
+
+#define BENCH_MAX_DEPTH 32
+#define BENCH_FUNCTIONS 500
+#define BENCH_RUNS 5
+
+// P1_StackFrame as it was before the arrays, later fields make it larger
+struct BenchStackFrame {
+    unsigned id;
+    DWORD64 dwAddr;
+    __int64 i64StartTime;
+    __int64 i64EndTime;
+    unsigned unTotalTime;
+    unsigned unSubTime;
+    unsigned unSelfTime;
+    unsigned unStartMem;
+    unsigned unEndMem;
+    unsigned idCaller;
+};
+
+static unsigned s_unSeed = 1;
+static unsigned Random() {
+    s_unSeed = s_unSeed * 1103515245 + 12345;
+    return (s_unSeed >> 16) & 0x7FFF;
+}
+
+// stack pointer of a call at the depth, deeper is lower
+static DWORD64 Key(unsigned unDepth) {
+    return 0x7FFF0000 - unDepth * 0x40;
+}
+
+// record unFrames frames, each a random call tree of unCalls calls
+void Record(unsigned unFrames, unsigned unCalls) {
+    g_objProfiler1.Start();
+    for (unsigned k = 0; k < unFrames; k++) {
+        g_objProfiler1.FrameStart();
+
+        DWORD64 arrAddr[BENCH_MAX_DEPTH];
+        unsigned unDepth = 0;
+        unsigned unEntered = 0;
+        while (unEntered < unCalls) {
+            if (unDepth > 0 && (unDepth == BENCH_MAX_DEPTH || Random() % 2 == 0)) {
+                unDepth--;
+                g_objProfiler1.ExitFrame(arrAddr[unDepth], Key(unDepth));
+            } else {
+                arrAddr[unDepth] = 0x401000 + (Random() % BENCH_FUNCTIONS) * 16;
+                g_objProfiler1.EnterFrame(arrAddr[unDepth], Key(unDepth));
+                unDepth++;
+                unEntered++;
+            }
+        }
+        while (unDepth > 0) {
+            unDepth--;
+            g_objProfiler1.ExitFrame(arrAddr[unDepth], Key(unDepth));
+        }
+
+        g_objProfiler1.FrameEnd();
+    }
+    g_objProfiler1.Stop();
+}
+
+double Seconds(std::chrono::steady_clock::time_point tpStart) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+}
+
+// copy the recorded frames into the original struct layout
+std::vector<std::vector<BenchStackFrame>> ToStructs(const std::vector<P1_FrameData>& vecFrames) {
+    std::vector<std::vector<BenchStackFrame>> vecStructs(vecFrames.size());
+    for (size_t k = 0; k < vecFrames.size(); k++) {
+        const P1_StackFrameArrays& stackFrames = vecFrames[k].stackFrames;
+        vecStructs[k].resize(stackFrames.size());
+        for (size_t i = 0; i < stackFrames.size(); i++) {
+            BenchStackFrame& frame = vecStructs[k][i];
+            frame.id = (unsigned)i;
+            frame.dwAddr = 0;
+            frame.i64StartTime = stackFrames.vecStartTime[i];
+            frame.i64EndTime = stackFrames.vecEndTime[i];
+            frame.unTotalTime = 0;
+            frame.unSubTime = 0;
+            frame.unSelfTime = 0;
+            frame.unStartMem = stackFrames.vecStartMem[i];
+            frame.unEndMem = stackFrames.vecEndMem[i];
+            frame.idCaller = stackFrames.vecCallerIds[i];
+        }
+    }
+    return vecStructs;
+}
+
+// total, sub and self time on the structs, the way Analyze() did before the arrays
+double TimeStructs(std::vector<std::vector<BenchStackFrame>>& vecFrames, __int64 i64Frequency) {
+    std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < vecFrames.size(); k++) {
+        std::vector<BenchStackFrame>& vecStackFrames = vecFrames[k];
+        for (size_t i = 0; i < vecStackFrames.size(); i++) {
+            BenchStackFrame& frame = vecStackFrames[i];
+            __int64 i64LocalTimeCost = frame.i64EndTime - frame.i64StartTime;
+            i64LocalTimeCost *= 1000000;
+            i64LocalTimeCost /= i64Frequency;
+            frame.unTotalTime = (unsigned)i64LocalTimeCost;
+            frame.unSubTime = 0;
+        }
+        for (size_t i = 0; i < vecStackFrames.size(); i++) {
+            BenchStackFrame& frame = vecStackFrames[i];
+            if (frame.idCaller != frame.id) {
+                vecStackFrames[frame.idCaller].unSubTime += frame.unTotalTime;
+            }
+        }
+        for (size_t i = 0; i < vecStackFrames.size(); i++) {
+            BenchStackFrame& frame = vecStackFrames[i];
+            frame.unSelfTime = frame.unTotalTime > frame.unSubTime ? frame.unTotalTime - frame.unSubTime : 0;
+        }
+    }
+    return Seconds(tpStart);
+}
+
+// the same on the stack frame arrays, with the vectorized kernels
+double TimeArrays(std::vector<P1_FrameData>& vecFrames, __int64 i64Frequency) {
+    double dTickToUs = 1000000.0 / i64Frequency;
+    std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < vecFrames.size(); k++) {
+        P1_StackFrameArrays& stackFrames = vecFrames[k].stackFrames;
+        size_t size = stackFrames.size();
+        P1_ComputeTotalTime(stackFrames.vecStartTime.data(), stackFrames.vecEndTime.data(), size,
+            dTickToUs, stackFrames.vecTotalTime.data());
+        stackFrames.vecSubTime.assign(size, 0);
+        for (size_t i = 0; i < size; i++) {
+            unsigned idCaller = stackFrames.vecCallerIds[i];
+            if (idCaller != i) {
+                stackFrames.vecSubTime[idCaller] += stackFrames.vecTotalTime[i];
+            }
+        }
+        P1_ComputeSelfTime(stackFrames.vecTotalTime.data(), stackFrames.vecSubTime.data(), size,
+            stackFrames.vecSelfTime.data());
+    }
+    return Seconds(tpStart);
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned unFrames = argc > 1 ? atoi(argv[1]) : 1000;
+    unsigned unCalls = argc > 2 ? atoi(argv[2]) : 2000;
+    double dEvents = (double)unFrames * unCalls;
+
+    Record(unFrames, unCalls);
+    std::cout << "frames: " << unFrames << ", calls per frame: " << unCalls << std::endl;
+
+    std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+    g_objProfiler1.Analyze();
+    double dAnalyze = Seconds(tpStart);
+    std::cout << "Analyze(): " << dAnalyze * 1000 << " ms, "
+        << dEvents / dAnalyze / 1000000 << " M calls/s" << std::endl;
+
+    // best of a few runs, the first one also pays for the page faults
+    std::vector<std::vector<BenchStackFrame>> vecStructs = ToStructs(g_objProfiler1.m_vecFrames);
+    double dStructs = 0;
+    double dArrays = 0;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        double dTime = TimeStructs(vecStructs, g_objProfiler1.i64Frequency);
+        dStructs = (i == 0 || dTime < dStructs) ? dTime : dStructs;
+        dTime = TimeArrays(g_objProfiler1.m_vecFrames, g_objProfiler1.i64Frequency);
+        dArrays = (i == 0 || dTime < dArrays) ? dTime : dArrays;
+    }
+
+    std::cout << "structs (" << sizeof(BenchStackFrame) << " bytes): " << dStructs * 1000 << " ms, "
+        << dStructs * 1e9 / dEvents << " ns/call" << std::endl;
+    std::cout << "arrays: " << dArrays * 1000 << " ms, "
+        << dArrays * 1e9 / dEvents << " ns/call" << std::endl;
+    std::cout << "speedup: " << dStructs / dArrays << "x" << std::endl;
+    return 0;
+}
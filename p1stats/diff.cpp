@@ -0,0 +1,202 @@
+﻿// diff.cpp: compare the statistic of two captures
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* see main.cpp
+**/
+
+#include "p1stats.h"
+
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+static bool CompareSelfTimeDelta(const P1_StatsDelta& dl, const P1_StatsDelta& dr) {
+    return dl.SelfTimeDelta() > dr.SelfTimeDelta();
+}
+
+std::vector<P1_StatsDelta> P1_DiffStatistic(const P1_StatsTable& before, const P1_StatsTable& after)
+{
+    std::vector<P1_StatsDelta> vecDeltas;
+    vecDeltas.reserve(before.vecRows.size() + after.vecRows.size());
+
+    for (size_t i = 0; i < before.vecRows.size(); i++) {
+        P1_StatsDelta delta;
+        delta.strName = before.vecRows[i].strName;
+        delta.rowBefore = before.vecRows[i];
+        const P1_StatsRow * pAfter = after.Find(delta.strName);
+        if (pAfter) {
+            delta.rowAfter = *pAfter;
+        }
+        delta.rowAfter.strName = delta.strName;
+        vecDeltas.push_back(delta);
+    }
+    for (size_t i = 0; i < after.vecRows.size(); i++) {
+        if (before.Find(after.vecRows[i].strName)) {
+            continue;
+        }
+        P1_StatsDelta delta;
+        delta.strName = after.vecRows[i].strName;
+        delta.rowBefore.strName = delta.strName;
+        delta.rowAfter = after.vecRows[i];
+        vecDeltas.push_back(delta);
+    }
+
+    if (before.bHistogram && after.bHistogram) {
+        for (size_t i = 0; i < vecDeltas.size(); i++) {
+            vecDeltas[i].dPValue = P1_MannWhitney(vecDeltas[i].rowBefore.arrSelfTimeHist,
+                vecDeltas[i].rowAfter.arrSelfTimeHist, P1_HIST_BUCKETS);
+        }
+    }
+
+    std::sort(vecDeltas.begin(), vecDeltas.end(), CompareSelfTimeDelta);
+    return vecDeltas;
+}
+
+double P1_MannWhitney(const __int64 * pHistA, const __int64 * pHistB, int nBuckets)
+{
+    double dCountA = 0;
+    double dCountB = 0;
+    for (int b = 0; b < nBuckets; b++) {
+        dCountA += (double)pHistA[b];
+        dCountB += (double)pHistB[b];
+    }
+    double dCount = dCountA + dCountB;
+    if (dCountA == 0 || dCountB == 0) {
+        return 1;
+    }
+
+    // every call in a bucket ties with the other calls of the bucket
+    double dU = 0;
+    double dBelowB = 0;
+    double dTies = 0;
+    for (int b = 0; b < nBuckets; b++) {
+        double dA = (double)pHistA[b];
+        double dB = (double)pHistB[b];
+        dU += dA * (dBelowB + dB / 2);
+        dBelowB += dB;
+        double dT = dA + dB;
+        dTies += dT * dT * dT - dT;
+    }
+
+    double dMean = dCountA * dCountB / 2;
+    double dVariance = dCountA * dCountB / 12 * ((dCount + 1) - dTies / (dCount * (dCount - 1)));
+    if (dVariance <= 0) {
+        return 1;
+    }
+    double dZ = fabs(dU - dMean) / sqrt(dVariance);
+    return erfc(dZ / sqrt(2.0));
+}
+
+static double Percent(__int64 i64Before, __int64 i64After)
+{
+    if (i64Before == 0) {
+        return 0;
+    }
+    return (double)(i64After - i64Before) * 100 / (double)i64Before;
+}
+
+bool P1_WriteDiffReport(const std::vector<P1_StatsDelta>& vecDeltas, double dAlpha, const char * filename)
+{
+    std::ofstream ostrm(filename, std::ofstream::trunc);
+    if (!ostrm) {
+        return false;
+    }
+    ostrm << "\"Name\",\"SelfTimeBefore(us)\",\"SelfTimeAfter(us)\",\"SelfTimeDelta(us)\",\"SelfTimeDelta(%)\","
+        << "\"TotalTimeBefore(us)\",\"TotalTimeAfter(us)\",\"TotalTimeDelta(us)\","
+        << "\"InvokeTimesBefore\",\"InvokeTimesAfter\",\"InvokeTimesDelta\","
+        << "\"MemoryBefore(bytes)\",\"MemoryAfter(bytes)\",\"MemoryDelta(bytes)\","
+        << "\"PValue\",\"Significant\"\n";
+    for (size_t i = 0; i < vecDeltas.size(); i++) {
+        const P1_StatsDelta& delta = vecDeltas[i];
+        const P1_StatsRow& before = delta.rowBefore;
+        const P1_StatsRow& after = delta.rowAfter;
+        ostrm << "\"" << delta.strName << "\",\""
+            << before.i64SelfTime << "\",\"" << after.i64SelfTime << "\",\""
+            << after.i64SelfTime - before.i64SelfTime << "\",\""
+            << std::fixed << std::setprecision(1) << Percent(before.i64SelfTime, after.i64SelfTime) << "\",\""
+            << before.i64TotalTime << "\",\"" << after.i64TotalTime << "\",\""
+            << after.i64TotalTime - before.i64TotalTime << "\",\""
+            << before.i64InvokeTimes << "\",\"" << after.i64InvokeTimes << "\",\""
+            << after.i64InvokeTimes - before.i64InvokeTimes << "\",\""
+            << before.i64Memory << "\",\"" << after.i64Memory << "\",\""
+            << after.i64Memory - before.i64Memory << "\",\""
+            << std::scientific << std::setprecision(3) << delta.dPValue << "\",\""
+            << (delta.dPValue < dAlpha ? "yes" : "no") << "\"\n";
+        ostrm.unsetf(std::ios_base::floatfield);
+    }
+    ostrm.close();
+    return true;
+}
+
+bool P1_WriteDiffFolded(const std::vector<P1_StatsDelta>& vecDeltas, const char * filename)
+{
+    std::ofstream ostrm(filename, std::ofstream::trunc);
+    if (!ostrm) {
+        return false;
+    }
+    for (size_t i = 0; i < vecDeltas.size(); i++) {
+        const P1_StatsDelta& delta = vecDeltas[i];
+        ostrm << delta.strName << " " << delta.rowBefore.i64SelfTime << " " << delta.rowAfter.i64SelfTime << "\n";
+    }
+    ostrm.close();
+    return true;
+}
+
+void P1_PrintDiff(const std::vector<P1_StatsDelta>& vecDeltas, double dAlpha, size_t szTop, std::ostream& ostrm)
+{
+    ostrm << std::setw(14) << "Self(us)" << std::setw(9) << "Self(%)" << std::setw(12) << "Calls"
+        << std::setw(11) << "PValue" << "  Name" << std::endl;
+
+    // regressions from the top, improvements from the bottom
+    size_t szRegressions = 0;
+    while (szRegressions < vecDeltas.size() && vecDeltas[szRegressions].SelfTimeDelta() > 0) {
+        szRegressions++;
+    }
+    std::vector<const P1_StatsDelta *> vecPrint;
+    for (size_t i = 0; i < szRegressions && i < szTop; i++) {
+        vecPrint.push_back(&vecDeltas[i]);
+    }
+    for (size_t i = 0; i < vecDeltas.size() - szRegressions && i < szTop; i++) {
+        const P1_StatsDelta& delta = vecDeltas[vecDeltas.size() - 1 - i];
+        if (delta.SelfTimeDelta() == 0) {
+            break;
+        }
+        vecPrint.push_back(&delta);
+    }
+
+    for (size_t i = 0; i < vecPrint.size(); i++) {
+        const P1_StatsDelta& delta = *vecPrint[i];
+        ostrm << std::showpos << std::setw(14) << delta.SelfTimeDelta()
+            << std::fixed << std::setprecision(1) << std::setw(9)
+            << Percent(delta.rowBefore.i64SelfTime, delta.rowAfter.i64SelfTime)
+            << std::setw(12) << delta.rowAfter.i64InvokeTimes - delta.rowBefore.i64InvokeTimes << std::noshowpos
+            << std::scientific << std::setprecision(2) << std::setw(11) << delta.dPValue
+            << (delta.dPValue < dAlpha ? " *" : "  ") << delta.strName << std::endl;
+        ostrm.unsetf(std::ios_base::floatfield);
+    }
+}
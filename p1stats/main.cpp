@@ -0,0 +1,211 @@
+﻿// main.cpp: command line of p1stats
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* p1stats diff <before.csv> <after.csv> [-o report.csv] [-f diff.folded] [-n top] [-a alpha]
+*     compare two files of WriteStatistic, or two of WriteCallPathStatistic.
+*     functions are matched by name, the report is ranked by the change of
+*     self time, * marks a significant change of the self time distribution
+*     (Mann-Whitney U test, alpha default 0.01).
+*     -f saves "stack before after" lines, the input of a differential flamegraph.pl
+* p1stats merge -o merged.csv [-j threads] [-k fan-in] <stats.csv> ...
+*     merge files of WriteStatistic (or of WriteCallPathStatistic) written by
+*     many processes, functions are matched by module, time stamp and offset.
+* p1stats series <stats.p1c> <name> [-o series.csv]
+*     self time, calls and memory of a function in every frame, from a file
+*     of WriteColumnarStatistic. functions of the same name are added up.
+**/
+
+#include "p1stats.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+void Usage() {
+    std::cout << "usage:" << std::endl
+        << "  p1stats diff <before.csv> <after.csv> [-o report.csv] [-f diff.folded] [-n top] [-a alpha]" << std::endl
+        << "  p1stats merge -o merged.csv [-j threads] [-k fan-in] <stats.csv> ..." << std::endl
+        << "  p1stats series <stats.p1c> <name> [-o series.csv]" << std::endl;
+}
+
+int Diff(int argc, char ** argv) {
+    if (argc < 4) {
+        Usage();
+        return 1;
+    }
+    const char * szReport = NULL;
+    const char * szFolded = NULL;
+    size_t szTop = 20;
+    double dAlpha = 0.01;
+    for (int i = 4; i < argc; i += 2) {
+        // every option takes a value
+        if (i + 1 == argc) {
+            Usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "-o") == 0) {
+            szReport = argv[i + 1];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            szFolded = argv[i + 1];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            szTop = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            dAlpha = atof(argv[i + 1]);
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    P1_StatsTable before;
+    P1_StatsTable after;
+    if (!P1_LoadStatistic(argv[2], before) || !P1_LoadStatistic(argv[3], after)) {
+        return 1;
+    }
+    if (before.bCallPaths != after.bCallPaths) {
+        std::cerr << "p1stats: can not compare function statistic with call path statistic" << std::endl;
+        return 1;
+    }
+
+    std::vector<P1_StatsDelta> vecDeltas = P1_DiffStatistic(before, after);
+    P1_PrintDiff(vecDeltas, dAlpha, szTop, std::cout);
+    if (!before.bHistogram || !after.bHistogram) {
+        std::cout << "no self time histogram, significance not tested" << std::endl;
+    }
+
+    if (szReport && !P1_WriteDiffReport(vecDeltas, dAlpha, szReport)) {
+        std::cerr << "p1stats: can not write " << szReport << std::endl;
+        return 1;
+    }
+    if (szFolded && !P1_WriteDiffFolded(vecDeltas, szFolded)) {
+        std::cerr << "p1stats: can not write " << szFolded << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int Merge(int argc, char ** argv) {
+    const char * szOutput = NULL;
+    unsigned unThreads = std::thread::hardware_concurrency();
+    size_t szFanIn = 64;
+    std::vector<std::string> vecInputs;
+    for (int i = 2; i < argc; i++) {
+        bool bOption = strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-k") == 0;
+        if (bOption && i + 1 == argc) {
+            Usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "-o") == 0) {
+            szOutput = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0) {
+            unThreads = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            szFanIn = strtoul(argv[++i], NULL, 10);
+        } else {
+            vecInputs.push_back(argv[i]);
+        }
+    }
+    if (!szOutput || vecInputs.empty()) {
+        Usage();
+        return 1;
+    }
+    if (!P1_MergeStatistic(vecInputs, szOutput, unThreads, szFanIn)) {
+        return 1;
+    }
+    std::cout << "merged " << vecInputs.size() << " files into " << szOutput << std::endl;
+    return 0;
+}
+
+int Series(int argc, char ** argv) {
+    if (argc < 4) {
+        Usage();
+        return 1;
+    }
+    const char * szOutput = NULL;
+    for (int i = 4; i < argc; i += 2) {
+        // every option takes a value
+        if (i + 1 == argc) {
+            Usage();
+            return 1;
+        }
+        if (strcmp(argv[i], "-o") == 0) {
+            szOutput = argv[i + 1];
+        } else {
+            Usage();
+            return 1;
+        }
+    }
+
+    P1_ColumnarReader reader;
+    if (!reader.Open(argv[2])) {
+        return 1;
+    }
+    P1_Series series;
+    if (!reader.ReadSeries(argv[3], series)) {
+        std::cerr << "p1stats: no function " << argv[3] << " in " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::ofstream ofstrm;
+    if (szOutput) {
+        ofstrm.open(szOutput, std::ofstream::trunc);
+        if (!ofstrm) {
+            std::cerr << "p1stats: can not write " << szOutput << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& ostrm = szOutput ? ofstrm : std::cout;
+    ostrm << "\"Frame\",\"StartTime\",\"FrameTime(us)\",\"SelfTime(us)\",\"InvokeTimes\",\"Memory(bytes)\"\n";
+    for (size_t k = 0; k < series.vecSelfTime.size(); k++) {
+        ostrm << "\"" << k << "\",\""
+            << reader.vecFrames[k].i64StartTime << "\",\""
+            << reader.vecFrames[k].unTotalTime << "\",\""
+            << series.vecSelfTime[k] << "\",\""
+            << series.vecInvokeTimes[k] << "\",\""
+            << series.vecMemory[k] << "\"\n";
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        Usage();
+        return 1;
+    }
+    if (strcmp(argv[1], "diff") == 0) {
+        return Diff(argc, argv);
+    }
+    if (strcmp(argv[1], "merge") == 0) {
+        return Merge(argc, argv);
+    }
+    if (strcmp(argv[1], "series") == 0) {
+        return Series(argc, argv);
+    }
+    Usage();
+    return 1;
+}
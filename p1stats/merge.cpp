@@ -0,0 +1,217 @@
+﻿// merge.cpp: merge the statistic of many processes
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* see main.cpp
+**/
+
+#include "p1stats.h"
+
+#include <sstream>
+#include <algorithm>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+
+static bool CompareKey(const P1_StatsRow& rl, const P1_StatsRow& rr) {
+    return rl.strKey < rr.strKey;
+}
+
+// sort one input by key into a run, rows of the same key are merged
+static bool SortRun(const std::string& strInput, const std::string& strRun, char& cCallPaths)
+{
+    P1_StatsReader reader;
+    if (!reader.Open(strInput.c_str())) {
+        return false;
+    }
+    cCallPaths = reader.bCallPaths;
+
+    std::vector<P1_StatsRow> vecRows;
+    P1_StatsRow row;
+    while (reader.Next(row)) {
+        vecRows.push_back(row);
+    }
+    std::sort(vecRows.begin(), vecRows.end(), CompareKey);
+
+    std::ofstream ostrm(strRun.c_str(), std::ofstream::trunc);
+    P1_WriteStatsHeader(ostrm, reader.bCallPaths);
+    for (size_t i = 0; i < vecRows.size(); i++) {
+        size_t j = i + 1;
+        while (j < vecRows.size() && vecRows[j].strKey == vecRows[i].strKey) {
+            vecRows[i].Merge(vecRows[j]);
+            j++;
+        }
+        P1_WriteStatsRow(ostrm, vecRows[i], reader.bCallPaths);
+        i = j - 1;
+    }
+    ostrm.close();
+    return !ostrm.fail();
+}
+
+// orders the heads of the runs, smallest key on top of the priority queue
+struct CompareHead {
+    const std::vector<P1_StatsRow> * pHeads;
+    bool operator()(size_t l, size_t r) const {
+        return (*pHeads)[r].strKey < (*pHeads)[l].strKey;
+    }
+};
+
+// k-way merge of sorted runs, only the head row of every run is in memory
+static bool MergeRuns(const std::vector<std::string>& vecRuns, const std::string& strOutput, bool bCallPaths)
+{
+    std::vector<P1_StatsReader> vecReaders(vecRuns.size());
+    std::vector<P1_StatsRow> vecHeads(vecRuns.size());
+    CompareHead compare;
+    compare.pHeads = &vecHeads;
+    std::priority_queue<size_t, std::vector<size_t>, CompareHead> queHeads(compare);
+    for (size_t i = 0; i < vecRuns.size(); i++) {
+        if (!vecReaders[i].Open(vecRuns[i].c_str())) {
+            return false;
+        }
+        if (vecReaders[i].Next(vecHeads[i])) {
+            queHeads.push(i);
+        }
+    }
+
+    std::ofstream ostrm(strOutput.c_str(), std::ofstream::trunc);
+    P1_WriteStatsHeader(ostrm, bCallPaths);
+    P1_StatsRow rowPending;
+    bool bPending = false;
+    while (!queHeads.empty()) {
+        size_t i = queHeads.top();
+        queHeads.pop();
+        if (bPending && rowPending.strKey == vecHeads[i].strKey) {
+            rowPending.Merge(vecHeads[i]);
+        } else {
+            if (bPending) {
+                P1_WriteStatsRow(ostrm, rowPending, bCallPaths);
+            }
+            rowPending = vecHeads[i];
+            bPending = true;
+        }
+        if (vecReaders[i].Next(vecHeads[i])) {
+            queHeads.push(i);
+        }
+    }
+    if (bPending) {
+        P1_WriteStatsRow(ostrm, rowPending, bCallPaths);
+    }
+    ostrm.close();
+    return !ostrm.fail();
+}
+
+static void RemoveRuns(const std::vector<std::string>& vecRuns)
+{
+    for (size_t i = 0; i < vecRuns.size(); i++) {
+        remove(vecRuns[i].c_str());
+    }
+}
+
+bool P1_MergeStatistic(const std::vector<std::string>& vecInputs, const char * filename,
+    unsigned unThreads, size_t szFanIn)
+{
+    if (vecInputs.empty()) {
+        return false;
+    }
+    unThreads = (std::max)(unThreads, 1u);
+    szFanIn = (std::max)(szFanIn, (size_t)2);
+
+    // sort every input into a run, in parallel
+    size_t szInputs = vecInputs.size();
+    std::vector<std::string> vecRuns(szInputs);
+    for (size_t i = 0; i < szInputs; i++) {
+        std::stringstream ss;
+        ss << filename << ".run0_" << i;
+        vecRuns[i] = ss.str();
+    }
+    std::vector<char> vecOk(szInputs, 0);
+    std::vector<char> vecCallPaths(szInputs, 0);
+    std::atomic<size_t> szNext(0);
+    std::vector<std::thread> vecThreads;
+    for (unsigned t = 0; t < unThreads && t < szInputs; t++) {
+        vecThreads.push_back(std::thread([&]() {
+            for (size_t i = szNext++; i < szInputs; i = szNext++) {
+                vecOk[i] = SortRun(vecInputs[i], vecRuns[i], vecCallPaths[i]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < vecThreads.size(); t++) {
+        vecThreads[t].join();
+    }
+
+    bool bOk = true;
+    for (size_t i = 0; i < szInputs; i++) {
+        if (!vecOk[i]) {
+            bOk = false;
+        } else if (vecCallPaths[i] != vecCallPaths[0]) {
+            std::cerr << "p1stats: can not merge function statistic with call path statistic: "
+                << vecInputs[i] << std::endl;
+            bOk = false;
+        }
+    }
+    if (!bOk) {
+        RemoveRuns(vecRuns);
+        return false;
+    }
+    bool bCallPaths = vecCallPaths[0] != 0;
+
+    // merge szFanIn runs at a time, until one pass can write the result
+    for (int nPass = 1; vecRuns.size() > szFanIn; nPass++) {
+        size_t szGroups = (vecRuns.size() + szFanIn - 1) / szFanIn;
+        std::vector<std::string> vecMerged(szGroups);
+        for (size_t g = 0; g < szGroups; g++) {
+            std::stringstream ss;
+            ss << filename << ".run" << nPass << "_" << g;
+            vecMerged[g] = ss.str();
+        }
+        std::vector<char> vecGroupOk(szGroups, 0);
+        szNext = 0;
+        vecThreads.clear();
+        for (unsigned t = 0; t < unThreads && t < szGroups; t++) {
+            vecThreads.push_back(std::thread([&]() {
+                for (size_t g = szNext++; g < szGroups; g = szNext++) {
+                    size_t szEnd = (std::min)((g + 1) * szFanIn, vecRuns.size());
+                    std::vector<std::string> vecGroup(vecRuns.begin() + g * szFanIn, vecRuns.begin() + szEnd);
+                    vecGroupOk[g] = MergeRuns(vecGroup, vecMerged[g], bCallPaths);
+                }
+            }));
+        }
+        for (size_t t = 0; t < vecThreads.size(); t++) {
+            vecThreads[t].join();
+        }
+        RemoveRuns(vecRuns);
+        vecRuns = vecMerged;
+        if (std::find(vecGroupOk.begin(), vecGroupOk.end(), 0) != vecGroupOk.end()) {
+            RemoveRuns(vecRuns);
+            return false;
+        }
+    }
+
+    bOk = MergeRuns(vecRuns, filename, bCallPaths);
+    RemoveRuns(vecRuns);
+    return bOk;
+}
@@ -0,0 +1,275 @@
+﻿// p1stats.cpp: load the statistic files of profiler1
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* see main.cpp
+**/
+
+#include "p1stats.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <iomanip>
+#include <algorithm>
+
+void P1_StatsTable::Add(const P1_StatsRow& row)
+{
+    std::unordered_map<std::string, size_t>::iterator it = mapRows.find(row.strName);
+    if (it != mapRows.end()) {
+        vecRows[it->second].Merge(row);
+        return;
+    }
+    mapRows[row.strName] = vecRows.size();
+    vecRows.push_back(row);
+}
+
+const P1_StatsRow * P1_StatsTable::Find(const std::string& strName) const
+{
+    std::unordered_map<std::string, size_t>::const_iterator it = mapRows.find(strName);
+    if (it == mapRows.end()) {
+        return NULL;
+    }
+    return &vecRows[it->second];
+}
+
+void P1_SplitCsvLine(const std::string& strLine, std::vector<std::string>& vecFields)
+{
+    vecFields.clear();
+    std::string strField;
+    bool bQuoted = false;
+    for (size_t i = 0; i < strLine.size(); i++) {
+        char c = strLine[i];
+        if (bQuoted) {
+            if (c == '"') {
+                if (i + 1 < strLine.size() && strLine[i + 1] == '"') {
+                    strField += '"';
+                    i++;
+                } else {
+                    bQuoted = false;
+                }
+            } else {
+                strField += c;
+            }
+        } else if (c == '"') {
+            bQuoted = true;
+        } else if (c == ',') {
+            vecFields.push_back(strField);
+            strField.clear();
+        } else if (c != '\r') {
+            strField += c;
+        }
+    }
+    vecFields.push_back(strField);
+}
+
+static int FindColumn(const std::vector<std::string>& vecHeader, const char * szName)
+{
+    for (size_t i = 0; i < vecHeader.size(); i++) {
+        if (vecHeader[i] == szName) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static __int64 ReadColumn(const std::vector<std::string>& vecFields, int nColumn)
+{
+    if (nColumn < 0 || nColumn >= (int)vecFields.size()) {
+        return 0;
+    }
+    return _strtoi64(vecFields[nColumn].c_str(), NULL, 10);
+}
+
+P1_StatsReader::P1_StatsReader()
+{
+    bCallPaths = false;
+    bHistogram = false;
+    m_nName = -1;
+    m_nModule = -1;
+    m_nOffset = -1;
+    m_nTimeStamp = -1;
+    m_nSelfTime = -1;
+    m_nTotalTime = -1;
+    m_nMemory = -1;
+    m_nInvokeTimes = -1;
+    m_nRecursiveInvokeTimes = -1;
+    m_nMaxRecursionDepth = -1;
+    m_nHistogram = -1;
+}
+
+bool P1_StatsReader::Open(const char * filename)
+{
+    m_istrm.open(filename);
+    if (!m_istrm) {
+        std::cerr << "p1stats: can not open " << filename << std::endl;
+        return false;
+    }
+
+    std::getline(m_istrm, m_strLine);
+    P1_SplitCsvLine(m_strLine, m_vecFields);
+
+    m_nName = FindColumn(m_vecFields, "Name");
+    bCallPaths = false;
+    if (m_nName < 0) {
+        m_nName = FindColumn(m_vecFields, "Path");
+        bCallPaths = true;
+    }
+    m_nModule = FindColumn(m_vecFields, "Module");
+    m_nOffset = FindColumn(m_vecFields, "Offset");
+    m_nTimeStamp = FindColumn(m_vecFields, "TimeStamp");
+    m_nSelfTime = FindColumn(m_vecFields, "TotalSelfTime(us)");
+    m_nTotalTime = FindColumn(m_vecFields, "TotalTime(us)");
+    m_nMemory = FindColumn(m_vecFields, "TotalMemory(bytes)");
+    m_nInvokeTimes = FindColumn(m_vecFields, "InvokeTimes");
+    m_nRecursiveInvokeTimes = FindColumn(m_vecFields, "RecursiveInvokeTimes");
+    m_nMaxRecursionDepth = FindColumn(m_vecFields, "MaxRecursionDepth");
+    m_nHistogram = FindColumn(m_vecFields, "SelfTimeHistogram");
+    if (m_nName < 0 || m_nSelfTime < 0 || m_nInvokeTimes < 0) {
+        std::cerr << "p1stats: " << filename << " is not a statistic file of profiler1" << std::endl;
+        return false;
+    }
+    bHistogram = m_nHistogram >= 0;
+    return true;
+}
+
+bool P1_StatsReader::Next(P1_StatsRow& row)
+{
+    while (std::getline(m_istrm, m_strLine)) {
+        if (m_strLine.empty()) {
+            continue;
+        }
+        P1_SplitCsvLine(m_strLine, m_vecFields);
+        if ((int)m_vecFields.size() <= m_nName) {
+            continue;
+        }
+        row = P1_StatsRow();
+        row.strName = m_vecFields[m_nName];
+        if (m_nModule >= 0 && m_nModule < (int)m_vecFields.size()) {
+            row.strModule = m_vecFields[m_nModule];
+        }
+        if (m_nOffset >= 0 && m_nOffset < (int)m_vecFields.size()) {
+            row.dwOffset = _strtoui64(m_vecFields[m_nOffset].c_str(), NULL, 16);
+        }
+        if (m_nTimeStamp >= 0 && m_nTimeStamp < (int)m_vecFields.size()) {
+            row.dwTimeStamp = strtoul(m_vecFields[m_nTimeStamp].c_str(), NULL, 16);
+        }
+        row.i64SelfTime = ReadColumn(m_vecFields, m_nSelfTime);
+        row.i64TotalTime = ReadColumn(m_vecFields, m_nTotalTime);
+        row.i64Memory = ReadColumn(m_vecFields, m_nMemory);
+        row.i64InvokeTimes = ReadColumn(m_vecFields, m_nInvokeTimes);
+        row.i64RecursiveInvokeTimes = ReadColumn(m_vecFields, m_nRecursiveInvokeTimes);
+        row.unMaxRecursionDepth = (unsigned)ReadColumn(m_vecFields, m_nMaxRecursionDepth);
+        if (m_nHistogram >= 0 && m_nHistogram < (int)m_vecFields.size()) {
+            const char * szHist = m_vecFields[m_nHistogram].c_str();
+            char * szEnd = NULL;
+            for (int b = 0; b < P1_HIST_BUCKETS && *szHist; b++) {
+                row.arrSelfTimeHist[b] = _strtoi64(szHist, &szEnd, 10);
+                szHist = szEnd;
+            }
+        }
+
+        // the same offset in another build of the module is another function
+        if (row.strModule.empty()) {
+            row.strKey = row.strName;
+        } else {
+            std::stringstream ss;
+            ss << row.strModule << "!" << std::hex << std::setw(8) << std::setfill('0') << row.dwTimeStamp
+                << "!" << std::setw(16) << row.dwOffset;
+            row.strKey = ss.str();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool P1_LoadStatistic(const char * filename, P1_StatsTable& table)
+{
+    P1_StatsReader reader;
+    if (!reader.Open(filename)) {
+        return false;
+    }
+    table.bCallPaths = reader.bCallPaths;
+    table.bHistogram = reader.bHistogram;
+
+    P1_StatsRow row;
+    while (reader.Next(row)) {
+        table.Add(row);
+    }
+    return true;
+}
+
+void P1_WriteStatsHeader(std::ostream& ostrm, bool bCallPaths)
+{
+    if (bCallPaths) {
+        ostrm << "\"Path\",\"AvgSelfTime(us)\",\"AvgTime(us)\",\"TotalSelfTime(us)\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\",\"SelfTimeHistogram\"\n";
+    } else {
+        ostrm << "\"Address\",\"Name\",\"AvgSelfTime(us)\",\"AvgTime(us)\",\"AvgMemory(bytes)\",\"TotalSelfTime(us)\",\"TotalTime(us)\",\"TotalMemory(bytes)\",\"InvokeTimes\",\"RecursiveInvokeTimes\",\"MaxRecursionDepth\",\"SelfTimeHistogram\",\"Module\",\"Offset\",\"TimeStamp\"\n";
+    }
+}
+
+void P1_WriteStatsRow(std::ostream& ostrm, const P1_StatsRow& row, bool bCallPaths)
+{
+    __int64 i64InvokeTimes = (std::max)(row.i64InvokeTimes, (__int64)1);
+    __int64 i64OuterInvokeTimes = (std::max)(row.i64InvokeTimes - row.i64RecursiveInvokeTimes, (__int64)1);
+    if (bCallPaths) {
+        ostrm << "\"" << row.strName << "\",\""
+            << row.i64SelfTime / i64InvokeTimes << "\",\""
+            << row.i64TotalTime / i64InvokeTimes << "\",\"";
+    } else {
+        ostrm << "\"\",\"" << row.strName << "\",\""
+            << row.i64SelfTime / i64InvokeTimes << "\",\""
+            << row.i64TotalTime / i64OuterInvokeTimes << "\",\""
+            << row.i64Memory / i64OuterInvokeTimes << "\",\"";
+    }
+    ostrm << row.i64SelfTime << "\",\""
+        << row.i64TotalTime << "\",\""
+        << row.i64Memory << "\",\""
+        << row.i64InvokeTimes << "\",\"";
+    if (!bCallPaths) {
+        ostrm << row.i64RecursiveInvokeTimes << "\",\""
+            << row.unMaxRecursionDepth << "\",\"";
+    }
+
+    int nBuckets = P1_HIST_BUCKETS;
+    while (nBuckets > 0 && row.arrSelfTimeHist[nBuckets - 1] == 0) {
+        nBuckets--;
+    }
+    for (int b = 0; b < nBuckets; b++) {
+        ostrm << (b ? " " : "") << row.arrSelfTimeHist[b];
+    }
+
+    if (!bCallPaths) {
+        ostrm << "\",\"" << row.strModule << "\",\"";
+        if (!row.strModule.empty()) {
+            ostrm << "0X" << std::uppercase << std::hex << row.dwOffset << "\",\"0X" << row.dwTimeStamp
+                << std::dec << std::nouppercase;
+        } else {
+            ostrm << "\",\"";
+        }
+    }
+    ostrm << "\"\n";
+}
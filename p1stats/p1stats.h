@@ -0,0 +1,261 @@
+﻿// p1stats.h: offline tools on the statistic files of profiler1
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* see main.cpp
+**/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+#include <fstream>
+#include "..\Profiler1\profiler1.h"
+
+/**
+ * @brief One row of a statistic file, a function (WriteStatistic) or
+ * a call path (WriteCallPathStatistic)
+ *
+ */
+struct P1_StatsRow {
+    std::string strName;        // function name, or folded call path
+    std::string strModule;      // module of the function, empty if unknown
+    DWORD64 dwOffset;           // offset of the function in the module
+    DWORD dwTimeStamp;          // time stamp of the module, tells builds apart
+    std::string strKey;         // module!timestamp!offset if known, else the name
+    __int64 i64SelfTime;        // total self time(us)
+    __int64 i64TotalTime;       // total time(us)
+    __int64 i64Memory;          // total memory(bytes)
+    __int64 i64InvokeTimes;
+    __int64 i64RecursiveInvokeTimes;
+    unsigned unMaxRecursionDepth;
+    __int64 arrSelfTimeHist[P1_HIST_BUCKETS];   // see P1_HIST_BUCKETS
+    P1_StatsRow() {
+        dwOffset = 0;
+        dwTimeStamp = 0;
+        i64SelfTime = 0;
+        i64TotalTime = 0;
+        i64Memory = 0;
+        i64InvokeTimes = 0;
+        i64RecursiveInvokeTimes = 0;
+        unMaxRecursionDepth = 0;
+        memset(arrSelfTimeHist, 0, sizeof(arrSelfTimeHist));
+    }
+    void Merge(const P1_StatsRow& other) {
+        i64SelfTime += other.i64SelfTime;
+        i64TotalTime += other.i64TotalTime;
+        i64Memory += other.i64Memory;
+        i64InvokeTimes += other.i64InvokeTimes;
+        i64RecursiveInvokeTimes += other.i64RecursiveInvokeTimes;
+        unMaxRecursionDepth = (std::max)(unMaxRecursionDepth, other.unMaxRecursionDepth);
+        for (int b = 0; b < P1_HIST_BUCKETS; b++) {
+            arrSelfTimeHist[b] += other.arrSelfTimeHist[b];
+        }
+    }
+};
+
+/**
+ * @brief Rows of a statistic file, rows with the same name are merged,
+ * as addresses differ from build to build
+ *
+ */
+struct P1_StatsTable {
+    bool bCallPaths;            // rows are call paths
+    bool bHistogram;            // the file has self time histograms
+    std::vector<P1_StatsRow> vecRows;
+    std::unordered_map<std::string, size_t> mapRows;    // name to index of vecRows
+    P1_StatsTable() {
+        bCallPaths = false;
+        bHistogram = false;
+    }
+    void Add(const P1_StatsRow& row);
+    const P1_StatsRow * Find(const std::string& strName) const;
+};
+
+/**
+ * @brief Read a statistic file row by row, columns are found by their header
+ *
+ */
+class P1_StatsReader {
+public:
+    P1_StatsReader();
+
+    /**
+     * @brief Open the file and read its header
+     *
+     * @return false if it is not a statistic file, the reason is printed
+     */
+    bool Open(const char * filename);
+
+    /**
+     * @brief Read the next row
+     *
+     * @return false at the end of the file
+     */
+    bool Next(P1_StatsRow& row);
+
+    bool bCallPaths;            // rows are call paths
+    bool bHistogram;            // the file has self time histograms
+private:
+    std::ifstream m_istrm;
+    std::string m_strLine;
+    std::vector<std::string> m_vecFields;
+    int m_nName;
+    int m_nModule;
+    int m_nOffset;
+    int m_nTimeStamp;
+    int m_nSelfTime;
+    int m_nTotalTime;
+    int m_nMemory;
+    int m_nInvokeTimes;
+    int m_nRecursiveInvokeTimes;
+    int m_nMaxRecursionDepth;
+    int m_nHistogram;
+};
+
+/**
+ * @brief Save the header and the rows of a statistic file, in the columns
+ * of WriteStatistic or WriteCallPathStatistic. Address is left empty,
+ * it has no meaning outside of its process
+ *
+ */
+void P1_WriteStatsHeader(std::ostream& ostrm, bool bCallPaths);
+void P1_WriteStatsRow(std::ostream& ostrm, const P1_StatsRow& row, bool bCallPaths);
+
+/**
+ * @brief Load a file of WriteStatistic or WriteCallPathStatistic, columns are
+ * found by their header, so files of older versions load as well
+ *
+ * @return false if the file could not be read, the reason is printed
+ */
+bool P1_LoadStatistic(const char * filename, P1_StatsTable& table);
+
+/**
+ * @brief Split one csv line, fields may be quoted
+ *
+ */
+void P1_SplitCsvLine(const std::string& strLine, std::vector<std::string>& vecFields);
+
+/**
+ * @brief Merge statistic files of many processes into one. Functions are
+ * matched by module and offset, so the load address of every process
+ * doesn't matter, call paths by name. Each input is sorted into a run on
+ * its own thread, then runs are merged szFanIn at a time, streaming, so
+ * memory does not grow with the number of inputs. The result is sorted
+ * by module and offset (or name).
+ *
+ * @return false if an input could not be read or the inputs are of different kinds
+ */
+bool P1_MergeStatistic(const std::vector<std::string>& vecInputs, const char * filename,
+    unsigned unThreads, size_t szFanIn);
+
+/**
+ * @brief Reader of a file of WriteColumnarStatistic. Only the header,
+ * the names and the block index are loaded, a series reads the cells of
+ * its functions from every block.
+ *
+ */
+class P1_ColumnarReader {
+public:
+    P1_ColumnarReader();
+
+    /**
+     * @brief Open the file and load its names, functions, frames and block index
+     *
+     * @return false if it is not a columnar statistic file, the reason is printed
+     */
+    bool Open(const char * filename);
+
+    /**
+     * @brief Read the series of a function, functions of the same name are
+     * added up, as their addresses differ from build to build
+     *
+     * @return false if no function has the name
+     */
+    bool ReadSeries(const std::string& strName, P1_Series& series);
+
+    std::vector<std::string> vecNames;
+    std::vector<P1_ColumnarFunction> vecFunctions;  // indexed by function id
+    std::vector<P1_ColumnarFrame> vecFrames;
+private:
+    std::ifstream m_istrm;
+    P1_ColumnarHeader m_header;
+    std::vector<DWORD64> m_vecBlockOffsets;
+};
+
+/**
+ * @brief Change of one function or call path between two captures
+ *
+ */
+struct P1_StatsDelta {
+    std::string strName;
+    P1_StatsRow rowBefore;      // empty if only in the second capture
+    P1_StatsRow rowAfter;       // empty if only in the first capture
+    double dPValue;             // Mann-Whitney U test of the self time histograms, 1 if none
+    P1_StatsDelta() {
+        dPValue = 1;
+    }
+    __int64 SelfTimeDelta() const {
+        return rowAfter.i64SelfTime - rowBefore.i64SelfTime;
+    }
+};
+
+/**
+ * @brief Match the rows of two captures by name, ranked by the change of
+ * self time, the largest regression first
+ *
+ */
+std::vector<P1_StatsDelta> P1_DiffStatistic(const P1_StatsTable& before, const P1_StatsTable& after);
+
+/**
+ * @brief Two sided p value of the Mann-Whitney U test on two histograms
+ * of the same buckets, ties are corrected for
+ *
+ */
+double P1_MannWhitney(const __int64 * pHistA, const __int64 * pHistB, int nBuckets);
+
+/**
+ * @brief Save the ranked deltas as csv
+ *
+ * @param dAlpha significance level of the PValue
+ */
+bool P1_WriteDiffReport(const std::vector<P1_StatsDelta>& vecDeltas, double dAlpha, const char * filename);
+
+/**
+ * @brief Save the self time of both captures in folded format,
+ * "caller;...;function before after" per line as difffolded.pl writes it,
+ * for a differential flamegraph.pl
+ *
+ */
+bool P1_WriteDiffFolded(const std::vector<P1_StatsDelta>& vecDeltas, const char * filename);
+
+/**
+ * @brief Print the top ranked deltas
+ *
+ */
+void P1_PrintDiff(const std::vector<P1_StatsDelta>& vecDeltas, double dAlpha, size_t szTop, std::ostream& ostrm);
@@ -0,0 +1,146 @@
+﻿// series.cpp: per frame series of a function from a columnar statistic file
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* see main.cpp
+**/
+
+#include "p1stats.h"
+
+#include <algorithm>
+
+P1_ColumnarReader::P1_ColumnarReader()
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+bool P1_ColumnarReader::Open(const char * filename)
+{
+    m_istrm.open(filename, std::ifstream::binary);
+    if (!m_istrm) {
+        std::cerr << "p1stats: can not open " << filename << std::endl;
+        return false;
+    }
+    m_istrm.read((char *)&m_header, sizeof(m_header));
+    if (!m_istrm || m_header.dwMagic != P1_COLUMNAR_MAGIC || m_header.dwVersion != P1_COLUMNAR_VERSION
+        || m_header.unBlockFrames == 0) {
+        std::cerr << "p1stats: " << filename << " is not a columnar statistic file of profiler1" << std::endl;
+        return false;
+    }
+
+    vecNames.resize(m_header.unNames);
+    for (unsigned i = 0; i < m_header.unNames; i++) {
+        unsigned unLength = 0;
+        m_istrm.read((char *)&unLength, sizeof(unLength));
+        vecNames[i].resize(unLength);
+        if (unLength) {
+            m_istrm.read(&vecNames[i][0], unLength);
+        }
+    }
+    vecFunctions.resize(m_header.unFunctions);
+    if (m_header.unFunctions) {
+        m_istrm.read((char *)&vecFunctions[0], m_header.unFunctions * sizeof(P1_ColumnarFunction));
+    }
+    vecFrames.resize(m_header.unFrames);
+    if (m_header.unFrames) {
+        m_istrm.read((char *)&vecFrames[0], m_header.unFrames * sizeof(P1_ColumnarFrame));
+    }
+
+    // the block index is at the end, its offset last
+    DWORD64 dwIndex = 0;
+    m_istrm.seekg(-(std::streamoff)sizeof(dwIndex), std::ifstream::end);
+    m_istrm.read((char *)&dwIndex, sizeof(dwIndex));
+    size_t szBlocks = (m_header.unFrames + m_header.unBlockFrames - 1) / m_header.unBlockFrames;
+    m_vecBlockOffsets.resize(szBlocks);
+    m_istrm.seekg((std::streamoff)dwIndex);
+    if (szBlocks) {
+        m_istrm.read((char *)&m_vecBlockOffsets[0], szBlocks * sizeof(DWORD64));
+    }
+    if (!m_istrm) {
+        std::cerr << "p1stats: " << filename << " is truncated" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool P1_ColumnarReader::ReadSeries(const std::string& strName, P1_Series& series)
+{
+    std::vector<unsigned> vecIds;
+    for (unsigned id = 0; id < vecFunctions.size(); id++) {
+        if (vecFunctions[id].idName < vecNames.size() && vecNames[vecFunctions[id].idName] == strName) {
+            vecIds.push_back(id);
+        }
+    }
+    if (vecIds.empty()) {
+        return false;
+    }
+
+    unsigned unFrames = m_header.unFrames;
+    series.vecSelfTime.assign(unFrames, 0);
+    series.vecInvokeTimes.assign(unFrames, 0);
+    series.vecMemory.assign(unFrames, 0);
+
+    std::vector<unsigned> vecEntries;
+    std::vector<unsigned> vecCells;
+    for (size_t b = 0; b < m_vecBlockOffsets.size(); b++) {
+        unsigned unFirst = (unsigned)b * m_header.unBlockFrames;
+        unsigned unCount = (std::min)(m_header.unBlockFrames, unFrames - unFirst);
+        m_istrm.seekg((std::streamoff)m_vecBlockOffsets[b]);
+        unsigned unEntries = 0;
+        m_istrm.read((char *)&unEntries, sizeof(unEntries));
+        if (!unEntries) {
+            continue;
+        }
+        vecEntries.resize(unEntries);
+        m_istrm.read((char *)&vecEntries[0], unEntries * sizeof(unsigned));
+        std::streamoff offColumns = m_istrm.tellg();
+        std::streamoff offColumn = (std::streamoff)unEntries * unCount * sizeof(unsigned);
+
+        // the cells of a function are a run in each column
+        vecCells.resize(unCount);
+        for (size_t i = 0; i < vecIds.size(); i++) {
+            std::vector<unsigned>::iterator it = std::lower_bound(vecEntries.begin(), vecEntries.end(), vecIds[i]);
+            if (it == vecEntries.end() || *it != vecIds[i]) {
+                continue;
+            }
+            std::streamoff offRun = (std::streamoff)(it - vecEntries.begin()) * unCount * sizeof(unsigned);
+            for (int c = 0; c < P1_COLUMNAR_COLUMNS; c++) {
+                m_istrm.seekg(offColumns + c * offColumn + offRun);
+                m_istrm.read((char *)&vecCells[0], unCount * sizeof(unsigned));
+                for (unsigned k = 0; k < unCount; k++) {
+                    if (c == 0) {
+                        series.vecSelfTime[unFirst + k] += vecCells[k];
+                    } else if (c == 1) {
+                        series.vecInvokeTimes[unFirst + k] += vecCells[k];
+                    } else {
+                        series.vecMemory[unFirst + k] += (int)vecCells[k];
+                    }
+                }
+            }
+        }
+    }
+    return !m_istrm.fail();
+}
@@ -0,0 +1,208 @@
+﻿// p1top.cpp: live view of a process profiled by profiler1
+
+/**
+* Profiler1 is a c++ profiler, aim to find out the time & memory cost
+* of each function call, with the help of compiler instrumentation,
+* using this library doesn't need to modify your source code.
+* This profiler could also use to trace the call stack, detect memory leak.
+*
+* Copyright(C) 2020 kohit (kohits@outlook.com or https://github.com/Kohit)
+*
+* The MIT License
+*     Permission is hereby granted, free of charge, to any person obtaining a copy
+*     of this software and associated documentation files (the "Software"), to deal
+*     in the Software without restriction, including without limitation the rights
+*     to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+*     of the Software, and to permit persons to whom the Software is furnished
+*     to do so, subject to the following conditions:
+*     The above copyright notice and this permission notice shall be included in all
+*     copies or substantial portions of the Software.
+*     THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+*     INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+*     PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+*     LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+*     TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+*     USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+* Usage:
+* p1top <process id> [refresh interval(ms)]
+* the profiled process publishes its frames after calling
+* g_objProfiler1.OpenLiveView(), p1top only reads the shared memory.
+* Functions are published by address, p1top looks up their names in the
+* symbols of the process.
+**/
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include "..\Profiler1\profiler1.h"
+
+#define P1TOP_WIDTH 100
+
+// names of the published functions, looked up once per address
+static HANDLE s_hProcess = NULL;
+static bool s_bSymbols = false;
+static std::unordered_map<DWORD64, std::string> s_mapNames;
+
+std::string GetFunctionName(const P1_LiveFunction& function) {
+    if (function.szName[0]) {
+        return function.szName;
+    }
+    std::unordered_map<DWORD64, std::string>::iterator it = s_mapNames.find(function.dwAddr);
+    if (it != s_mapNames.end()) {
+        return it->second;
+    }
+
+    char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(TCHAR)];
+    PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)buffer;
+    pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    pSymbol->MaxNameLen = MAX_SYM_NAME;
+    DWORD64 dwDisplacement = 0;
+    // modules loaded since SymInitialize are picked up by a refresh
+    if (s_bSymbols && (SymFromAddr(s_hProcess, function.dwAddr, &dwDisplacement, pSymbol)
+        || (SymRefreshModuleList(s_hProcess) && SymFromAddr(s_hProcess, function.dwAddr, &dwDisplacement, pSymbol)))) {
+        return s_mapNames[function.dwAddr] = pSymbol->Name;
+    }
+    std::stringstream ss;
+    ss << "0X" << std::hex << std::uppercase << function.dwAddr;
+    return s_mapNames[function.dwAddr] = ss.str();
+}
+
+// copy the view, retry while the profiler is writing it
+bool ReadView(const P1_LiveView * pShared, P1_LiveView& view) {
+    for (int nTry = 0; nTry < 1000; nTry++) {
+        LONG lBegin = pShared->lSequence;
+        if (lBegin & 1) {
+            Sleep(0);
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(&view, (const void *)pShared, sizeof(P1_LiveView));
+        MemoryBarrier();
+        if (pShared->lSequence == lBegin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// pad every line to the console width, so the previous screen is overwritten
+void PrintLine(std::ostream& ostrm, const std::string& str) {
+    ostrm << std::left << std::setw(P1TOP_WIDTH) << str.substr(0, P1TOP_WIDTH) << std::right << "\n";
+}
+
+void Print(const P1_LiveView& view, double dFramesPerSec) {
+    std::stringstream ssScreen;
+    std::stringstream ss;
+
+    unsigned unFrames = (std::min)(view.unFrames, (unsigned)P1_LIVE_FRAMES);
+    unsigned unLast = 0;
+    unsigned unMax = 0;
+    double dTotal = 0;
+    for (unsigned i = 0; i < unFrames; i++) {
+        const P1_LiveFrame& frame = view.arrFrames[(view.unFrames - 1 - i) % P1_LIVE_FRAMES];
+        if (i == 0) {
+            unLast = frame.unTotalTime;
+        }
+        unMax = (std::max)(unMax, frame.unTotalTime);
+        dTotal += frame.unTotalTime;
+    }
+
+    ss << "p1top - process " << view.dwProcessId << ", frames: " << view.unFrames
+        << ", " << std::fixed << std::setprecision(1) << dFramesPerSec << " frames/s";
+    PrintLine(ssScreen, ss.str());
+    ss.str("");
+    ss << "frame time(us): last " << unLast << ", avg " << std::setprecision(0)
+        << (unFrames ? dTotal / unFrames : 0) << ", max " << unMax << " (last " << unFrames << " frames)";
+    PrintLine(ssScreen, ss.str());
+    PrintLine(ssScreen, "");
+
+    ss.str("");
+    ss << std::setw(10) << "Self(us)" << std::setw(10) << "Time(us)" << std::setw(8) << "Calls"
+        << std::setw(14) << "TotalSelf(ms)" << std::setw(12) << "TotalCalls" << "  Name";
+    PrintLine(ssScreen, ss.str());
+    for (unsigned i = 0; i < P1_LIVE_TOP; i++) {
+        ss.str("");
+        if (i < view.unFunctions) {
+            const P1_LiveFunction& function = view.arrFunctions[i];
+            ss << std::setw(10) << function.unFrameSelfTime << std::setw(10) << function.unFrameTotalTime
+                << std::setw(8) << function.unFrameInvokeTimes
+                << std::setw(14) << std::setprecision(1) << function.unTotalSelfTime / 1000.0
+                << std::setw(12) << function.unInvokeTimes << "  " << GetFunctionName(function);
+        }
+        PrintLine(ssScreen, ss.str());
+    }
+
+    COORD coord = { 0, 0 };
+    SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coord);
+    std::cout << ssScreen.str() << std::flush;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        std::cout << "usage: p1top <process id> [refresh interval(ms)]" << std::endl;
+        return 1;
+    }
+    DWORD dwProcessId = strtoul(argv[1], NULL, 10);
+    DWORD dwInterval = argc > 2 ? strtoul(argv[2], NULL, 10) : 500;
+
+    std::stringstream ssName;
+    ssName << "Local\\Profiler1_" << dwProcessId;
+    HANDLE hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, ssName.str().c_str());
+    if (!hMapping) {
+        std::cout << "p1top: no live view of process " << dwProcessId
+            << ", did it call OpenLiveView()? error: " << GetLastError() << std::endl;
+        return 1;
+    }
+    const P1_LiveView * pShared = (const P1_LiveView *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, sizeof(P1_LiveView));
+    if (!pShared || pShared->dwMagic != P1_LIVE_MAGIC) {
+        std::cout << "p1top: unknown live view layout" << std::endl;
+        CloseHandle(hMapping);
+        return 1;
+    }
+    HANDLE hProcess = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, dwProcessId);
+    if (hProcess) {
+        s_hProcess = hProcess;
+        s_bSymbols = SymInitialize(hProcess, NULL, TRUE) != FALSE;
+    } else {
+        // no access to the symbols, functions are shown by address
+        hProcess = OpenProcess(SYNCHRONIZE, FALSE, dwProcessId);
+    }
+
+    P1_LiveView * pView = new P1_LiveView;
+    unsigned unLastFrames = 0;
+    ULONGLONG ullLastTick = GetTickCount64();
+    system("cls");
+    while (!hProcess || WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT) {
+        Sleep(dwInterval);
+        if (!ReadView(pShared, *pView)) {
+            continue;
+        }
+
+        // frames counter is reset by Start()
+        ULONGLONG ullTick = GetTickCount64();
+        unsigned unNewFrames = pView->unFrames >= unLastFrames ? pView->unFrames - unLastFrames : pView->unFrames;
+        double dFramesPerSec = ullTick > ullLastTick ? unNewFrames * 1000.0 / (ullTick - ullLastTick) : 0;
+        unLastFrames = pView->unFrames;
+        ullLastTick = ullTick;
+
+        Print(*pView, dFramesPerSec);
+    }
+    std::cout << "p1top: process " << dwProcessId << " exited" << std::endl;
+
+    delete pView;
+    if (s_bSymbols) {
+        SymCleanup(hProcess);
+    }
+    if (hProcess) {
+        CloseHandle(hProcess);
+    }
+    UnmapViewOfFile(pShared);
+    CloseHandle(hMapping);
+    return 0;
+}
@@ -27,6 +27,7 @@
 **/
 
 #include <iostream>
+#include <thread>
 #include "..\Profiler1\profiler1.h"
 
 const char * echo() {
@@ -47,8 +48,12 @@ public:
         a++;
         bla();
         bla();
-        for (int i = 1; i < 100; i++) {
-            echo();
+        {
+            // zones work in code compiled without /Gh /GH as well
+            P1_ZONE("Bar::add echo loop");
+            for (int i = 1; i < 100; i++) {
+                echo();
+            }
         }
         return a;
     }
@@ -83,6 +88,142 @@ void RunTest(int i){
     }
 }
 
+void Recurse(int n) {
+    P1_ZONE("Recurse zone");
+    if (n > 1) {
+        Recurse(n - 1);
+    }
+}
+
+// the checks below return the number of mismatches, main() fails on any of them
+int Check(bool bOk, const char * szWhat) {
+    if (!bOk) {
+        std::cout << "check failed: " << szWhat << std::endl;
+    }
+    return bOk ? 0 : 1;
+}
+
+// the vectorized kernels against the scalar definition, on every length up to
+// a few vectors so that the scalar tails are covered, at odd offsets
+int CheckKernels() {
+    const size_t szMax = 37;
+    const double dTickToUs = 0.1;
+    std::vector<__int64> vecStart(szMax + 1), vecEnd(szMax + 1);
+    std::vector<unsigned> vecTotal(szMax + 2), vecSub(szMax + 1), vecSelf(szMax + 2);
+    unsigned unSeed = 12345;
+    for (size_t i = 0; i <= szMax; i++) {
+        unSeed = unSeed * 1103515245 + 12345;
+        vecStart[i] = (__int64)unSeed << 8;
+        switch (i % 4) {
+        case 0: vecEnd[i] = vecStart[i] + unSeed % 100000; break;
+        case 1: vecEnd[i] = vecStart[i] - 5; break;                  // ended before start
+        case 2: vecEnd[i] = vecStart[i] + (1LL << 40); break;        // over the limit
+        default: vecEnd[i] = vecStart[i]; break;
+        }
+        vecSub[i] = unSeed % 20000;
+    }
+
+    int nErrors = 0;
+    for (size_t szCount = 0; szCount <= szMax - 1; szCount++) {
+        for (size_t szOffset = 0; szOffset < 2; szOffset++) {
+            const unsigned unGuard = 0xCDCDCDCD;
+            vecTotal[szOffset + szCount] = unGuard;
+            vecSelf[szOffset + szCount] = unGuard;
+            P1_ComputeTotalTime(&vecStart[szOffset], &vecEnd[szOffset], szCount, dTickToUs, &vecTotal[szOffset]);
+            P1_ComputeSelfTime(&vecTotal[szOffset], &vecSub[szOffset], szCount, &vecSelf[szOffset]);
+            bool bOk = vecTotal[szOffset + szCount] == unGuard && vecSelf[szOffset + szCount] == unGuard;
+            for (size_t i = szOffset; i < szOffset + szCount; i++) {
+                __int64 i64Ticks = vecEnd[i] - vecStart[i];
+                unsigned unTotal = i64Ticks > 0 ? (unsigned)((std::min)(i64Ticks * dTickToUs, 2147483647.0)) : 0;
+                unsigned unSelf = unTotal > vecSub[i] ? unTotal - vecSub[i] : 0;
+                bOk = bOk && vecTotal[i] == unTotal && vecSelf[i] == unSelf;
+            }
+            if (!bOk) {
+                std::cout << "kernels mismatch, count " << szCount << " offset " << szOffset << std::endl;
+                nErrors++;
+            }
+        }
+    }
+    return nErrors;
+}
+
+// threads registering the same addresses get the same dense ids
+int CheckRegistry() {
+    P1_FunctionRegistry * pRegistry = new P1_FunctionRegistry;
+    const unsigned unAddrs = 1000;
+    std::vector<std::vector<unsigned>> vecIds(4, std::vector<unsigned>(unAddrs));
+    std::vector<std::thread> vecThreads;
+    for (size_t t = 0; t < vecIds.size(); t++) {
+        vecThreads.push_back(std::thread([pRegistry, &vecIds, t, unAddrs]() {
+            for (unsigned i = 0; i < unAddrs; i++) {
+                vecIds[t][i] = pRegistry->GetId(0x10000 + (DWORD64)i * 16);
+            }
+        }));
+    }
+    for (size_t t = 0; t < vecThreads.size(); t++) {
+        vecThreads[t].join();
+    }
+
+    int nErrors = Check(pRegistry->Size() == unAddrs, "registry size");
+    std::vector<bool> vecSeen(unAddrs, false);
+    for (unsigned i = 0; i < unAddrs; i++) {
+        unsigned id = vecIds[0][i];
+        bool bOk = id < unAddrs && !vecSeen[id] && pRegistry->GetAddress(id) == 0x10000 + (DWORD64)i * 16;
+        for (size_t t = 1; t < vecIds.size(); t++) {
+            bOk = bOk && vecIds[t][i] == id;
+        }
+        if (bOk) {
+            vecSeen[id] = true;
+        }
+        nErrors += Check(bOk, "registry id");
+    }
+    delete pRegistry;
+    return nErrors;
+}
+
+// a capture of known shape: 3 frames, each recursing 4 deep
+int CheckRecursion() {
+    g_objProfiler1.ClearBudgets();
+    g_objProfiler1.Start();
+    for (int i = 0; i < 3; i++) {
+        g_objProfiler1.FrameStart();
+        Recurse(4);
+        g_objProfiler1.FrameEnd();
+    }
+    g_objProfiler1.Stop();
+    g_objProfiler1.Analyze();
+
+    int nErrors = 0;
+    bool bFound = false;
+    std::vector<P1_StatsUnit> vecStats = g_objProfiler1.GetStatistic();
+    for (size_t i = 0; i < vecStats.size(); i++) {
+        P1_StatsUnit& unit = vecStats[i];
+        if (unit.strName == "Recurse zone") {
+            bFound = true;
+            nErrors += Check(unit.unInvokeTimes == 12, "recursion invoke times");
+            nErrors += Check(unit.unRecursiveInvokeTimes == 9, "recursive invoke times");
+            nErrors += Check(unit.unMaxRecursionDepth == 4, "max recursion depth");
+            nErrors += Check(unit.unTotalTime >= unit.unTotalSlefTime, "outermost total time covers self time");
+        }
+    }
+    nErrors += Check(bFound, "recursion zone in statistic");
+
+    unsigned idPass = g_objProfiler1.AddSelfTimeBudget("Recurse zone", 100, 1e9);
+    unsigned idFail = g_objProfiler1.AddSelfTimeBudget("Recurse zone", 50, -1);
+    unsigned idFrames = g_objProfiler1.AddFrameTimeBudget(1e9);
+    unsigned idMissing = g_objProfiler1.AddSelfTimeBudget("no such function", 95, 1e9);
+    std::vector<P1_BudgetResult> vecResults = g_objProfiler1.CheckBudgets();
+    nErrors += Check(vecResults.size() == 4, "budget results");
+    if (vecResults.size() == 4) {
+        nErrors += Check(vecResults[idPass].bPass && vecResults[idPass].unSamples == 12, "self time budget passes");
+        nErrors += Check(!vecResults[idFail].bPass && vecResults[idFail].unViolations == 12, "self time budget fails");
+        nErrors += Check(vecResults[idFrames].bPass && vecResults[idFrames].unSamples == 3, "frame time budget passes");
+        nErrors += Check(!vecResults[idMissing].bPass && vecResults[idMissing].unSamples == 0, "budget of nothing fails");
+    }
+    g_objProfiler1.ClearBudgets();
+    return nErrors;
+}
+
 int main()
 {
     // test lib load surcessful
@@ -98,6 +239,7 @@ int main()
         g_objProfiler1.FrameStart();
 
         // do something in this frame
+        P1_COUNTER("test case", i);
         RunTest(i);
 
         // end profiler logging
@@ -125,15 +267,49 @@ int main()
     // write statistic result of each frame
     g_objProfiler1.WriteFrameStatistic("statsFrame.csv");
     /* result may look like:
-    "id","StartTime","TotalTime(us)","TotalMemory(bytes)","InvokeTimes"
-    "0","18","37","4096","4"
-    "1","67","26","0","4"
-    "2","106","136","405504","4"
-    "3","258","490","0","107"
-    "4","766","459","0","107"
+    "id","StartTime","TotalTime(us)","TotalMemory(bytes)","InvokeTimes","Markers","UnwoundFrames","OrphanExits","test case.Min","test case.Max","test case.Avg","test case.Last"
+    "0","18","37","4096","4","0","0","0","0","0","0","0"
+    "1","67","26","0","4","0","0","0","1","1","1","1"
+    "2","106","136","405504","4","0","0","0","2","2","2","2"
+    "3","258","490","0","107","0","0","0","3","3","3","3"
+    "4","766","459","0","107","0","0","0","4","4","4","4"
     */
     // memory increased 405504 bytes after frame 2
 
+    // write every call, counter and marker in chrome trace event format
+    g_objProfiler1.WriteTimeline("timeline.json");
+
+    // write statistic result of every call path, compare two builds with
+    // p1stats diff statsPathOld.csv statsPath.csv -f diff.folded
+    g_objProfiler1.WriteCallPathStatistic("statsPath.csv");
+
+    // write the modules, to symbolize the Module/Offset columns offline
+    g_objProfiler1.WriteModuleMap("modules.csv");
+
+    // write the call paths that made the slowest frames slow, against the median frame
+    g_objProfiler1.WriteOutlierReport("outliers.csv");
+
+    // write every function of every frame in one file, read a function back with
+    // p1stats series stats.p1c RunTest
+    g_objProfiler1.WriteColumnarStatistic("stats.p1c");
+
+    // write statistic result of every source file, functions of a file added up
+    g_objProfiler1.WriteRollupStatistic("statsFile.csv", P1_ROLLUP_FILE);
+
+    // fail the test when a budget is broken, or when a budget checked nothing
+    g_objProfiler1.AddSelfTimeBudget("RunTest", 95, 1000);     // p95 self time of RunTest < 1ms
+    g_objProfiler1.AddFrameTimeBudget(5000);                   // every frame < 5ms
+    g_objProfiler1.WriteBudgetReport("budgets.json");
+    int nResult = 0;
+    std::vector<P1_BudgetResult> vecResults = g_objProfiler1.CheckBudgets();
+    for (size_t b = 0; b < vecResults.size(); b++) {
+        if (!vecResults[b].bPass) {
+            std::cout << "budget " << b << " failed: " << vecResults[b].dValue << " in "
+                << vecResults[b].unSamples << " samples" << std::endl;
+            nResult = 1;
+        }
+    }
+
     // below shows how to trace caller for every function call in frame 0
     std::vector<P1_StackFrame> stackFrames = g_objProfiler1.GetFrames()[0].vecStackFrames;
     {
@@ -187,6 +363,11 @@ int main()
     --------------------------
     */
 
-    return 0;
+    // check the kernels, the registry, and a synthetic capture, this starts a new capture
+    if (CheckKernels() + CheckRegistry() + CheckRecursion() != 0) {
+        nResult = 1;
+    }
+
+    return nResult;
 }
 